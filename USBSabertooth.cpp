@@ -19,7 +19,7 @@ USE OR PERFORMANCE OF THIS SOFTWARE.
 #include "USBSabertooth_NB.h"
 
 USBSabertooth::USBSabertooth(USBSabertoothSerial& serial, byte address)
-  : _address(address), _serial(serial), _crc(true)
+  : _address(address), _serial(serial), _crc(!SABERTOOTH_CHECKSUM_ONLY), _units(NULL), _shadow(NULL), _sampler(NULL)
 {}
 
 void USBSabertooth::command(USBSabertoothCommand cmd,
@@ -107,14 +107,67 @@ void USBSabertooth::set(byte type, byte number, int value)
 void USBSabertooth::set(byte type, byte number, int value,
                          USBSabertoothSetType setType)
 {
+  if (_shadow)
+  {
+    if (number == '*')   // all outputs, for example ramping, or every motor at once
+    {
+      _shadow->record(USBSabertoothShadow::channel(type, 1, setType), value);
+      _shadow->record(USBSabertoothShadow::channel(type, 2, setType), value);
+    }
+    else
+    {
+      _shadow->record(USBSabertoothShadow::channel(type, number, setType), value);
+    }
+  }
+  if (_sampler && type == 'M' && setType == SABERTOOTH_SET_VALUE) { _sampler->setpoint(*this, number, value); }
   _serial.set( _address, _crc, type, number, value, setType); 
 }
 
+boolean USBSabertooth::update(byte type, byte number, int value)
+{
+  if (_shadow)
+  {
+    USBSabertoothShadowChannel channel = USBSabertoothShadow::channel(type, number, SABERTOOTH_SET_VALUE);
+    if (channel < SABERTOOTH_SHADOW_CHANNELS && _shadow->known(channel) &&
+        _shadow->value(channel) == constrain(value, -SABERTOOTH_MAX_VALUE, SABERTOOTH_MAX_VALUE)) { return false; }
+  }
+  set(type, number, value);
+  return true;
+}
+
+// type, number and set type of every shadow channel
+static const byte shadowTypes  [SABERTOOTH_SHADOW_CHANNELS] = { 'M', 'M', 'M', 'M', 'P', 'P', 'Q', 'Q', 'R', 'R', 'M', 'M', 'P', 'P' };
+static const byte shadowNumbers[SABERTOOTH_SHADOW_CHANNELS] = {  1,   2,  'D', 'T',  1,   2,   1,   2,   1,   2,   1,   2,   1,   2  };
+
+void USBSabertooth::resend(USBSabertoothShadowChannel channel)
+{
+  USBSabertoothSetType setType = channel >= SABERTOOTH_SHADOW_SHUTDOWN_M1 ? SABERTOOTH_SET_SHUTDOWN : SABERTOOTH_SET_VALUE;
+  _serial.set( _address, _crc, shadowTypes[channel], shadowNumbers[channel], _shadow->value(channel), setType );
+}
+
+void USBSabertooth::refresh()
+{
+  USBSabertoothShadowChannel channel;
+  if (_shadow && _shadow->nextRefresh(&channel)) { resend(channel); }
+}
+
+void USBSabertooth::resendAll()
+{
+  if (!_shadow) { return; }
+  for (byte i = 0; i < SABERTOOTH_SHADOW_CHANNELS; i ++)
+  {
+    USBSabertoothShadowChannel channel = (USBSabertoothShadowChannel)i;
+    if (_shadow->known(channel)) { resend(channel); }
+  }
+}
+
+#if !SABERTOOTH_NO_SYNC_GET
 int USBSabertooth::get(byte type, byte number,
                        USBSabertoothGetType getType, boolean unscaled)
 {
   return _serial.get( _address, _crc, type, number, getType, unscaled );
 }
+#endif
 
 boolean USBSabertooth::async_get(byte type, byte number,
                        USBSabertoothGetType getType, int context, boolean unscaled)
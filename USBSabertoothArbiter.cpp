@@ -0,0 +1,203 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+USBSabertoothArbiter::USBSabertoothArbiter(USBSabertoothSerial& serial, uint32_t baud)
+  : _serial(serial), _count(0), _timeout(SABERTOOTH_DEFAULT_GET_TIMEOUT),
+    _txFree(0), _rxFree(0), _turnMin(0), _turnMax(SABERTOOTH_TICKS_PER_MS),
+    _sent(0), _overlapped(0), _mismatches(0)
+{
+  setBaud(baud);
+}
+
+void USBSabertoothArbiter::setBaud(uint32_t baud)
+{
+  _baud = baud ? baud : 9600;
+}
+
+USBSabertoothTicks USBSabertoothArbiter::lineTicks(byte bytes) const
+{
+  // start, 8 data and stop bits, rounded up so windows err on the long side
+  uint32_t bits = (uint32_t)bytes * 10 * 1000 * SABERTOOTH_TICKS_PER_MS;
+  return (USBSabertoothTicks)((bits + _baud - 1) / _baud);
+}
+
+boolean USBSabertoothArbiter::async_get(const USBSabertooth& driver, byte type, byte number,
+                                        USBSabertoothGetType getType, int context, boolean unscaled)
+{
+  if (_count >= SABERTOOTH_ARBITER_SLOTS) { return false; }
+  
+  // take the first slot not in use
+  byte index = 0;
+  for (boolean used = true; used; )
+  {
+    used = false;
+    for (byte i = 0; i < _count; i ++) { if (_order[i] == index) { used = true; index ++; break; } }
+  }
+  
+  USBSabertoothRequest& request = _slots[index];
+  request.commandData[0] = (byte)getType | (unscaled ? 2 : 0);
+  request.commandData[1] = type;
+  request.commandData[2] = number;
+  request.context = context;
+  request.address = driver.address();
+  request.crc = SABERTOOTH_USE_CRC(driver.usingCRC());
+  request.expire();
+  request.clearDeadline();
+  
+  _order[_count ++] = index;
+  return true;
+}
+
+void USBSabertoothArbiter::sendDue()
+{
+  for (byte i = 0; i < _count; i ++)
+  {
+    USBSabertoothRequest& request = _slots[_order[i]];
+    if (request.pending() || request.missedDeadline()) { continue; }   // the latter is reported as timed out
+    
+    // one get per driver at a time, and the replies outstanding must be through first
+    boolean outstanding = false, busy = false;
+    for (byte j = 0; j < _count; j ++)
+    {
+      const USBSabertoothRequest& other = _slots[_order[j]];
+      if (!other.pending()) { continue; }
+      outstanding = true;
+      if (other.address == request.address) { busy = true; }
+    }
+    if (busy) { continue; }
+    
+    USBSabertoothTicks now = (USBSabertoothTicks)USBSabertoothTimeout::now();
+    USBSabertoothTicks txEnd = (USBSabertoothTimeout::later(_txFree, now) ? _txFree : now) + lineTicks(request.crc ? 8 : 7);
+    USBSabertoothTicks rxStart = _rxFree + lineTicks(1), replyStart = txEnd + _turnMin;
+    if (outstanding && USBSabertoothTimeout::later(rxStart, replyStart)) { return; }   // keep the order
+    
+    _serial.write(request.address, SABERTOOTH_CMD_GET, request.crc, request.commandData, SABERTOOTH_GETCOMMAND_DATA_LENGTH);
+    request.setTimeoutTicks(_timeout.timeoutTicks());
+    request.reset();
+    
+    _txFree = txEnd;
+    _rxFree = txEnd + _turnMax + lineTicks(request.crc ? 10 : 9);
+    _sent ++;
+    if (outstanding) { _overlapped ++; }
+  }
+}
+
+boolean USBSabertoothArbiter::setDeadlineTicks(int context, int32_t ticks)
+{
+  boolean found = false;
+  for (byte index = 0; index < _count; index ++)
+  {
+    USBSabertoothRequest& request = _slots[_order[index]];
+    if (request.context == context && !request.cancelled()) { request.setDeadlineTicks(ticks); found = true; }
+  }
+  return found;
+}
+
+boolean USBSabertoothArbiter::cancel(int context)
+{
+  boolean found = false;
+  for (byte index = 0; index < _count; )
+  {
+    USBSabertoothRequest& request = _slots[_order[index]];
+    if (request.context != context || request.cancelled()) { index ++; continue; }
+    
+    // gets not sent yet go right away, the others once their reply or timeout is in
+    found = true;
+    if (request.pending()) { request.cancel(); request.clearDeadline(); index ++; }
+    else                   { remove(index); }
+  }
+  return found;
+}
+
+void USBSabertoothArbiter::remove(byte index)
+{
+  _slots[_order[index]].expire();
+  _count --;
+  for (byte i = index; i < _count; i ++) { _order[i] = _order[i + 1]; }
+}
+
+void USBSabertoothArbiter::complete(byte index, byte* address, byte* type, byte* number, int* context)
+{
+  const USBSabertoothRequest& request = _slots[_order[index]];
+  *address = request.address;
+  *type    = request.commandData[1];
+  *number  = request.commandData[2];
+  *context = request.context;
+  remove(index);
+}
+
+boolean USBSabertoothArbiter::reply_available(byte* address, byte* type, byte* number, int* result, int* context)
+{
+  sendDue();
+  
+  // match every reply framed to the get it answers, within the budget of the serial
+  Stream& port = _serial.port();
+  USBSabertoothTicks start = (USBSabertoothTicks)USBSabertoothTimeout::now();
+  for (uint16_t bytes = 0; _serial.withinBudget(bytes, start); bytes ++)
+  {
+    int value = port.read();
+    if (value < 0) { break; }
+    
+    _receiver.read((byte)value);
+    if (!_receiver.ready()) { continue; }
+    
+    if (_serial._capture) { _serial.captureReply(_receiver); }
+    
+    const byte* data = _receiver.data();
+    byte index = 0;
+    for (; index < _count; index ++)
+    {
+      const USBSabertoothRequest& request = _slots[_order[index]];
+      if (request.pending() &&
+          request.address  ==  _receiver.address() && request.crc == _receiver.usingCRC() &&
+          _receiver.command() == SABERTOOTH_RC_GET &&
+          request.commandData[0] == (data[2] & ~1) &&
+          request.commandData[1] ==  data[6] &&
+          request.commandData[2] ==  data[7]) { break; }
+    }
+    if (index == _count) { _receiver.reset(); _mismatches ++; continue; }
+    if (_slots[_order[index]].cancelled()) { _receiver.reset(); remove(index); continue; }
+    
+    int16_t magnitude = (uint16_t)data[4] << 0 | (uint16_t)data[5] << 7;
+    *result = (data[2] & 1) ? -magnitude : magnitude;
+    _receiver.reset();
+    complete(index, address, type, number, context);
+    return true;
+  }
+  
+  for (byte index = 0; index < _count; index ++)
+  {
+    const USBSabertoothRequest& request = _slots[_order[index]];
+    if (request.pending() ? request.expired() : request.missedDeadline())
+    {
+      if (request.cancelled()) { remove(index --); continue; }
+      *result = SABERTOOTH_GET_TIMED_OUT;
+      complete(index, address, type, number, context);
+      return true;
+    }
+  }
+  return false;
+}
+
+boolean USBSabertoothArbiter::reply_available(int* result, int* context)
+{
+  byte address, type, number;
+  return reply_available(&address, &type, &number, result, context);
+}
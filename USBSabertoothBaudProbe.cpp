@@ -0,0 +1,126 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+#define SABERTOOTH_PROBE_SETTLE_MS   100   /* time for both ends to switch baud rate */
+
+USBSabertoothBaudProbe::USBSabertoothBaudProbe(USBSabertoothSerial& serial, USBSabertooth& driver,
+                                               USBSabertoothBaudSetter setter, void* user)
+  : _serial(serial), _driver(driver), _setter(setter), _user(user),
+    _count(0), _index(0), _minPercent(99), _gets(0), _waiting(false), _timer(SABERTOOTH_PROBE_SETTLE_MS), _best(0), _current(0)
+{}
+
+void USBSabertoothBaudProbe::begin(const uint32_t* rates, byte count, uint16_t gets, byte minPercent, uint32_t current)
+{
+  _count = count < SABERTOOTH_PROBE_RATES ? count : SABERTOOTH_PROBE_RATES;
+  for (byte i = 0; i < _count; i ++)
+  {
+    memset(&_results[i], 0, sizeof(_results[i]));
+    _results[i].baud = rates[i];
+  }
+  _gets = gets; _minPercent = minPercent; _current = current;
+  _index = 0; _best = 0; _waiting = false;
+  
+  if (_count)
+  {
+    _setter(_results[0].baud, _user);
+    _timer.setTimeoutMS(SABERTOOTH_PROBE_SETTLE_MS);
+    _timer.reset();
+  }
+}
+
+boolean USBSabertoothBaudProbe::good(const USBSabertoothBaudResult& result) const
+{
+  return result.sent && (uint32_t)result.replies * 100 >= (uint32_t)result.sent * _minPercent;
+}
+
+void USBSabertoothBaudProbe::tally()
+{
+  // the last reply is only cut once the line went quiet
+  _decoder.finish();
+  
+  USBSabertoothBaudResult& result = _results[_index];
+  const USBSabertoothAddressStats& stats = _decoder.stats(_driver.address());
+  uint16_t rejects = 0;
+  for (byte address = 0; address < 8; address ++) { rejects += _decoder.stats(address).invalid; }
+  
+  if (stats.replies) { result.replies ++; } else { result.timeouts ++; }
+  result.rejects += rejects;
+  _decoder.reset();
+}
+
+boolean USBSabertoothBaudProbe::run()
+{
+  if (done()) { return true; }
+  
+  // decode everything arriving, including whatever is still on the line after a switch
+  Stream& port = _serial.port();
+  byte buffer[16]; size_t length = 0;
+  for (int value; length < sizeof(buffer) && (value = port.read()) >= 0; ) { buffer[length ++] = (byte)value; }
+  if (_waiting) { _decoder.decode(buffer, length); }
+  
+  if (!_timer.expired()) { return false; }
+  
+  USBSabertoothBaudResult& result = _results[_index];
+  if (_waiting) { tally(); _waiting = false; }
+  
+  if (result.sent < _gets)
+  {
+    // a get and its reply take 17 or 18 bytes on the line, leave as much again for the driver
+    byte data[SABERTOOTH_GETCOMMAND_DATA_LENGTH] = { SABERTOOTH_GET_BATTERY, 'M', 1 };
+    _serial.write(_driver.address(), SABERTOOTH_CMD_GET, SABERTOOTH_USE_CRC(_driver.usingCRC()), data, sizeof(data));
+    result.sent ++;
+    
+    uint32_t window = 36UL * 10 * 1000 * SABERTOOTH_TICKS_PER_MS / result.baud + 2 * SABERTOOTH_TICKS_PER_MS;
+    _timer.setTimeoutTicks(window);
+    _timer.reset();
+    _waiting = true;
+    return false;
+  }
+  
+  // this rate is through: on to the next one, or settle on the fastest good one
+  if (good(result) && result.baud > _best) { _best = result.baud; }
+  
+  if (++ _index < _count)
+  {
+    _setter(_results[_index].baud, _user);
+    _timer.setTimeoutMS(SABERTOOTH_PROBE_SETTLE_MS);
+    _timer.reset();
+    return false;
+  }
+  
+  // nothing passed: go back to where the line was rather than stay on the last rate tried
+  if (_best) { _setter(_best, _user); }
+  else if (_current) { _setter(_current, _user); }
+  return true;
+}
+
+void USBSabertoothBaudProbe::printCSV(Print& out) const
+{
+  for (byte i = 0; i < _count; i ++)
+  {
+    const USBSabertoothBaudResult& result = _results[i];
+    out.print(result.baud);     out.print(',');
+    out.print(result.sent);     out.print(',');
+    out.print(result.replies);  out.print(',');
+    out.print(result.rejects);  out.print(',');
+    out.print(result.timeouts); out.print(',');
+    out.println(good(result) ? 1 : 0);
+  }
+}
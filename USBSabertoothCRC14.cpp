@@ -23,6 +23,49 @@ void USBSabertoothCRC14::begin()
   _crc = 0x3fff;
 }
 
+#if SABERTOOTH_CRC_TABLES
+// crc14Table[i] is the register after shifting the 8 bits of i through the polynomial
+static const uint16_t crc14Table[256] PROGMEM =
+{
+  0x0000, 0x3b71, 0x3303, 0x0872, 0x23e7, 0x1896, 0x10e4, 0x2b95,
+  0x022f, 0x395e, 0x312c, 0x0a5d, 0x21c8, 0x1ab9, 0x12cb, 0x29ba,
+  0x045e, 0x3f2f, 0x375d, 0x0c2c, 0x27b9, 0x1cc8, 0x14ba, 0x2fcb,
+  0x0671, 0x3d00, 0x3572, 0x0e03, 0x2596, 0x1ee7, 0x1695, 0x2de4,
+  0x08bc, 0x33cd, 0x3bbf, 0x00ce, 0x2b5b, 0x102a, 0x1858, 0x2329,
+  0x0a93, 0x31e2, 0x3990, 0x02e1, 0x2974, 0x1205, 0x1a77, 0x2106,
+  0x0ce2, 0x3793, 0x3fe1, 0x0490, 0x2f05, 0x1474, 0x1c06, 0x2777,
+  0x0ecd, 0x35bc, 0x3dce, 0x06bf, 0x2d2a, 0x165b, 0x1e29, 0x2558,
+  0x1178, 0x2a09, 0x227b, 0x190a, 0x329f, 0x09ee, 0x019c, 0x3aed,
+  0x1357, 0x2826, 0x2054, 0x1b25, 0x30b0, 0x0bc1, 0x03b3, 0x38c2,
+  0x1526, 0x2e57, 0x2625, 0x1d54, 0x36c1, 0x0db0, 0x05c2, 0x3eb3,
+  0x1709, 0x2c78, 0x240a, 0x1f7b, 0x34ee, 0x0f9f, 0x07ed, 0x3c9c,
+  0x19c4, 0x22b5, 0x2ac7, 0x11b6, 0x3a23, 0x0152, 0x0920, 0x3251,
+  0x1beb, 0x209a, 0x28e8, 0x1399, 0x380c, 0x037d, 0x0b0f, 0x307e,
+  0x1d9a, 0x26eb, 0x2e99, 0x15e8, 0x3e7d, 0x050c, 0x0d7e, 0x360f,
+  0x1fb5, 0x24c4, 0x2cb6, 0x17c7, 0x3c52, 0x0723, 0x0f51, 0x3420,
+  0x22f0, 0x1981, 0x11f3, 0x2a82, 0x0117, 0x3a66, 0x3214, 0x0965,
+  0x20df, 0x1bae, 0x13dc, 0x28ad, 0x0338, 0x3849, 0x303b, 0x0b4a,
+  0x26ae, 0x1ddf, 0x15ad, 0x2edc, 0x0549, 0x3e38, 0x364a, 0x0d3b,
+  0x2481, 0x1ff0, 0x1782, 0x2cf3, 0x0766, 0x3c17, 0x3465, 0x0f14,
+  0x2a4c, 0x113d, 0x194f, 0x223e, 0x09ab, 0x32da, 0x3aa8, 0x01d9,
+  0x2863, 0x1312, 0x1b60, 0x2011, 0x0b84, 0x30f5, 0x3887, 0x03f6,
+  0x2e12, 0x1563, 0x1d11, 0x2660, 0x0df5, 0x3684, 0x3ef6, 0x0587,
+  0x2c3d, 0x174c, 0x1f3e, 0x244f, 0x0fda, 0x34ab, 0x3cd9, 0x07a8,
+  0x3388, 0x08f9, 0x008b, 0x3bfa, 0x106f, 0x2b1e, 0x236c, 0x181d,
+  0x31a7, 0x0ad6, 0x02a4, 0x39d5, 0x1240, 0x2931, 0x2143, 0x1a32,
+  0x37d6, 0x0ca7, 0x04d5, 0x3fa4, 0x1431, 0x2f40, 0x2732, 0x1c43,
+  0x35f9, 0x0e88, 0x06fa, 0x3d8b, 0x161e, 0x2d6f, 0x251d, 0x1e6c,
+  0x3b34, 0x0045, 0x0837, 0x3346, 0x18d3, 0x23a2, 0x2bd0, 0x10a1,
+  0x391b, 0x026a, 0x0a18, 0x3169, 0x1afc, 0x218d, 0x29ff, 0x128e,
+  0x3f6a, 0x041b, 0x0c69, 0x3718, 0x1c8d, 0x27fc, 0x2f8e, 0x14ff,
+  0x3d45, 0x0634, 0x0e46, 0x3537, 0x1ea2, 0x25d3, 0x2da1, 0x16d0
+};
+
+void USBSabertoothCRC14::write(byte data)
+{
+  _crc = (_crc >> 8) ^ pgm_read_word(&crc14Table[(byte)(_crc ^ data)]);
+}
+#else
 void USBSabertoothCRC14::write(byte data)
 {
   _crc ^= data;
@@ -40,6 +83,8 @@ void USBSabertoothCRC14::write(byte data)
   }
 }
 
+#endif
+
 void USBSabertoothCRC14::write(const byte* data, size_t lengthOfData)
 {
   for (size_t i = 0; i < lengthOfData; i ++) { write(data[i]); }
@@ -23,6 +23,33 @@ void USBSabertoothCRC7::begin()
   _crc = 0x7f;
 }
 
+#if SABERTOOTH_CRC_TABLES
+// crc7Table[i] is the register after shifting the 8 bits of i through the polynomial
+static const byte crc7Table[256] PROGMEM =
+{
+  0x00, 0x2c, 0x58, 0x74, 0x5d, 0x71, 0x05, 0x29, 0x57, 0x7b, 0x0f, 0x23, 0x0a, 0x26, 0x52, 0x7e,
+  0x43, 0x6f, 0x1b, 0x37, 0x1e, 0x32, 0x46, 0x6a, 0x14, 0x38, 0x4c, 0x60, 0x49, 0x65, 0x11, 0x3d,
+  0x6b, 0x47, 0x33, 0x1f, 0x36, 0x1a, 0x6e, 0x42, 0x3c, 0x10, 0x64, 0x48, 0x61, 0x4d, 0x39, 0x15,
+  0x28, 0x04, 0x70, 0x5c, 0x75, 0x59, 0x2d, 0x01, 0x7f, 0x53, 0x27, 0x0b, 0x22, 0x0e, 0x7a, 0x56,
+  0x3b, 0x17, 0x63, 0x4f, 0x66, 0x4a, 0x3e, 0x12, 0x6c, 0x40, 0x34, 0x18, 0x31, 0x1d, 0x69, 0x45,
+  0x78, 0x54, 0x20, 0x0c, 0x25, 0x09, 0x7d, 0x51, 0x2f, 0x03, 0x77, 0x5b, 0x72, 0x5e, 0x2a, 0x06,
+  0x50, 0x7c, 0x08, 0x24, 0x0d, 0x21, 0x55, 0x79, 0x07, 0x2b, 0x5f, 0x73, 0x5a, 0x76, 0x02, 0x2e,
+  0x13, 0x3f, 0x4b, 0x67, 0x4e, 0x62, 0x16, 0x3a, 0x44, 0x68, 0x1c, 0x30, 0x19, 0x35, 0x41, 0x6d,
+  0x76, 0x5a, 0x2e, 0x02, 0x2b, 0x07, 0x73, 0x5f, 0x21, 0x0d, 0x79, 0x55, 0x7c, 0x50, 0x24, 0x08,
+  0x35, 0x19, 0x6d, 0x41, 0x68, 0x44, 0x30, 0x1c, 0x62, 0x4e, 0x3a, 0x16, 0x3f, 0x13, 0x67, 0x4b,
+  0x1d, 0x31, 0x45, 0x69, 0x40, 0x6c, 0x18, 0x34, 0x4a, 0x66, 0x12, 0x3e, 0x17, 0x3b, 0x4f, 0x63,
+  0x5e, 0x72, 0x06, 0x2a, 0x03, 0x2f, 0x5b, 0x77, 0x09, 0x25, 0x51, 0x7d, 0x54, 0x78, 0x0c, 0x20,
+  0x4d, 0x61, 0x15, 0x39, 0x10, 0x3c, 0x48, 0x64, 0x1a, 0x36, 0x42, 0x6e, 0x47, 0x6b, 0x1f, 0x33,
+  0x0e, 0x22, 0x56, 0x7a, 0x53, 0x7f, 0x0b, 0x27, 0x59, 0x75, 0x01, 0x2d, 0x04, 0x28, 0x5c, 0x70,
+  0x26, 0x0a, 0x7e, 0x52, 0x7b, 0x57, 0x23, 0x0f, 0x71, 0x5d, 0x29, 0x05, 0x2c, 0x00, 0x74, 0x58,
+  0x65, 0x49, 0x3d, 0x11, 0x38, 0x14, 0x60, 0x4c, 0x32, 0x1e, 0x6a, 0x46, 0x6f, 0x43, 0x37, 0x1b
+};
+
+void USBSabertoothCRC7::write(byte data)
+{
+  _crc = pgm_read_byte(&crc7Table[(byte)(_crc ^ data)]);
+}
+#else
 void USBSabertoothCRC7::write(byte data)
 {
   _crc ^= data;
@@ -40,6 +67,8 @@ void USBSabertoothCRC7::write(byte data)
   }
 }
 
+#endif
+
 void USBSabertoothCRC7::write(const byte* data, size_t lengthOfData)
 {
   for (size_t i = 0; i < lengthOfData; i ++) { write(data[i]); }
@@ -0,0 +1,67 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+USBSabertoothCapture::USBSabertoothCapture(byte* buffer, size_t size)
+  : _buffer(buffer), _size(size), _start(0), _used(0)
+{}
+
+void USBSabertoothCapture::record(USBSabertoothCaptureDirection direction, const byte* data, size_t length)
+{
+  size_t needed = 5 + length;
+  if (length > SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH || needed > _size) { return; }
+  
+  // drop the oldest records until the new one fits
+  while (_size - _used < needed)
+  {
+    size_t dropped = 5 + (at(0) & 0x0f);
+    _start = (_start + dropped) % _size; _used -= dropped;
+  }
+  
+  uint32_t time = USBSabertoothTimeout::now();
+  byte header[5] = { (byte)(direction | length),
+                     (byte)(time >>  0), (byte)(time >>  8),
+                     (byte)(time >> 16), (byte)(time >> 24) };
+                     
+  size_t end = (_start + _used) % _size;
+  for (size_t i = 0; i < 5;      i ++) { _buffer[(end + i    ) % _size] = header[i]; }
+  for (size_t i = 0; i < length; i ++) { _buffer[(end + 5 + i) % _size] = data[i];   }
+  _used += needed;
+}
+
+boolean USBSabertoothCapture::read(size_t* position, USBSabertoothCaptureRecord* record) const
+{
+  size_t i = *position;
+  if (i >= _used) { return false; }
+  
+  byte header = at(i);
+  record->direction = header & 0x80;
+  record->length    = header & 0x0f;
+  record->time      = (uint32_t)at(i + 1) <<  0 | (uint32_t)at(i + 2) <<  8 |
+                      (uint32_t)at(i + 3) << 16 | (uint32_t)at(i + 4) << 24;
+  for (byte j = 0; j < record->length; j ++) { record->data[j] = at(i + 5 + j); }
+  
+  *position = i + 5 + record->length;
+  return true;
+}
+
+void USBSabertoothCapture::writeTo(Print& out) const
+{
+  for (size_t i = 0; i < _used; i ++) { out.write(at(i)); }
+}
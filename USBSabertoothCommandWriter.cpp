@@ -24,6 +24,7 @@ size_t USBSabertoothCommandWriter::writeToBuffer(byte* buffer, byte address,
 {
   size_t i = 0;
   
+  useCRC = SABERTOOTH_USE_CRC(useCRC);
   if (useCRC) { address |= 0xf0; }
   buffer[i ++] = address;
   buffer[i ++] = (byte)command;
@@ -0,0 +1,117 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+static const int32_t fullScale = 65536;   // a scale of 1, full power
+
+USBSabertoothCurrentLimiter::USBSabertoothCurrentLimiter(USBSabertoothSerial& serial, USBSabertooth& driver)
+  : _serial(serial), _driver(driver), _kp(32), _ki(192), _next(0), _busy(false), _updates(0), _errors(0)
+{
+  for (byte i = 0; i < 2; i ++)
+  {
+    Channel& channel = _channels[i];
+    channel.limit = channel.requested = channel.sent = channel.current = 0;
+    channel.integral = channel.scale = fullScale;
+    channel.enabled = false;
+  }
+}
+
+void USBSabertoothCurrentLimiter::setLimit(byte motorOutputNumber, int limit)
+{
+  Channel& channel = _channels[(motorOutputNumber - 1) & 1];
+  channel.limit = limit;
+  channel.enabled = true;
+}
+
+void USBSabertoothCurrentLimiter::clearLimit(byte motorOutputNumber)
+{
+  byte index = (motorOutputNumber - 1) & 1;
+  Channel& channel = _channels[index];
+  channel.enabled = false;
+  channel.integral = channel.scale = fullScale;
+  apply(index);
+}
+
+void USBSabertoothCurrentLimiter::motor(byte motorOutputNumber, int power)
+{
+  byte index = (motorOutputNumber - 1) & 1;
+  _channels[index].requested = constrain(power, -2047, 2047);
+  apply(index, true);   // always send, it also keeps the driver alive
+}
+
+void USBSabertoothCurrentLimiter::apply(byte index, boolean force)
+{
+  Channel& channel = _channels[index];
+  int16_t power = (int16_t)(((int32_t)channel.requested * channel.scale) / fullScale);
+  if (power == channel.sent && !force) { return; }
+  
+  channel.sent = power;
+  _driver.motor(index + 1, power);
+}
+
+boolean USBSabertoothCurrentLimiter::run()
+{
+  boolean updated = false;
+  
+  if (_busy)
+  {
+    int result, context;
+    if (!_serial.reply_available(&result, &context)) { return false; }
+    _busy = false;
+    
+    if (result == SABERTOOTH_GET_TIMED_OUT || result == SABERTOOTH_GET_ERROR)
+    {
+      _errors ++;
+    }
+    else if (_channels[context].enabled)   // the limit may have been cleared while the get was in flight
+    {
+      // PI on the distance to the limit; the integral is held within the scale range so it
+      // can not wind up while the current is well under the limit
+      Channel& channel = _channels[context];
+      channel.current = result;
+      int32_t error = (int32_t)channel.limit - abs(result);
+      
+      channel.integral = constrain(channel.integral + _ki * error, (int32_t)0, fullScale);
+      channel.scale    = constrain(channel.integral + _kp * error, (int32_t)0, fullScale);
+      apply(context);
+      
+      _updates ++;
+      updated = true;
+    }
+    else
+    {
+      _channels[context].current = result;
+    }
+  }
+  
+  // the limited outputs take turns
+  for (byte i = 0; i < 2; i ++)
+  {
+    byte index = (_next + i) & 1;
+    if (!_channels[index].enabled) { continue; }
+    
+    if (_driver.async_getCurrent(index + 1, index))
+    {
+      _busy = true;
+      _next = index + 1;
+    }
+    break;
+  }
+  return updated;
+}
@@ -0,0 +1,194 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+USBSabertoothEmulator::USBSabertoothEmulator(uint32_t baud)
+{
+  setBaud(baud);
+  _addresses = 0xff;
+  _turnaroundMicros = 0;
+  setNoise(0, 0);
+  setReadings(240, 25, 100);
+  reset();
+}
+
+void USBSabertoothEmulator::setBaud(uint32_t baud)
+{
+  _baud = baud ? baud : 9600;
+  _byteMicros = (10000000UL + _baud / 2) / _baud;   // start, 8 data and stop bits
+}
+
+void USBSabertoothEmulator::setReadings(int battery, int temperature, int fullCurrent)
+{
+  _battery = battery; _temperature = temperature; _fullCurrent = fullCurrent;
+}
+
+void USBSabertoothEmulator::setNoise(uint32_t cleanBaud, uint16_t perMille, uint32_t seed)
+{
+  _cleanBaud = cleanBaud; _noisePerMille = perMille;
+  _seed = seed ? seed : 1;
+}
+
+byte USBSabertoothEmulator::noise(byte data)
+{
+  if (!_cleanBaud || _baud <= _cleanBaud) { return data; }
+  
+  // xorshift32, reproducible from the seed
+  _seed ^= _seed << 13; _seed ^= _seed >> 17; _seed ^= _seed << 5;
+  uint32_t over = (_baud - _cleanBaud) * 16 / _cleanBaud;   // in sixteenths of cleanBaud
+  uint32_t chance = (uint32_t)_noisePerMille * over / 16;
+  if (_seed % 1000 >= chance) { return data; }
+  
+  _corrupted ++;
+  return data ^ (1 << ((_seed >> 10) & 7));
+}
+
+int USBSabertoothEmulator::value(byte address, byte type, byte number) const
+{
+  return _values[address & 7][(type == 'P' ? 2 : 0) + (number == 2 || number == '2')];
+}
+
+void USBSabertoothEmulator::reset()
+{
+  memset(_values, 0, sizeof(_values));
+  _packetLength = 0;
+  _txFree = _rxFree = nowMicros();
+  _queueStart = _queueLength = 0;
+  _packets = _invalid = _txBusyMicros = _rxBusyMicros = _collisions = _corrupted = 0;
+  _rxAddress = 0;
+}
+
+uint32_t USBSabertoothEmulator::nowMicros()
+{
+  return USBSabertoothTimeout::now() * (1000 / SABERTOOTH_TICKS_PER_MS);
+}
+
+int USBSabertoothEmulator::available()
+{
+  uint32_t now = nowMicros(); int count = 0;
+  while (count < _queueLength && !USBSabertoothTimeout::later(_queueTime[(_queueStart + count) % SABERTOOTH_EMULATOR_QUEUE_LENGTH], now)) { count ++; }
+  return count;
+}
+
+int USBSabertoothEmulator::peek()
+{
+  if (!_queueLength || USBSabertoothTimeout::later(_queueTime[_queueStart], nowMicros())) { return -1; }
+  return _queue[_queueStart];
+}
+
+int USBSabertoothEmulator::read()
+{
+  int data = peek();
+  if (data >= 0)
+  {
+    _queueStart = (_queueStart + 1) % SABERTOOTH_EMULATOR_QUEUE_LENGTH; _queueLength --;
+  }
+  return data;
+}
+
+size_t USBSabertoothEmulator::write(uint8_t data)
+{
+  // the byte is on the line once the previous one is through
+  uint32_t now = nowMicros();
+  if (!USBSabertoothTimeout::later(_txFree, now)) { _txFree = now; }
+  _txFree += _byteMicros; _txBusyMicros += _byteMicros;
+  data = noise(data);
+  
+  if (data & 0x80) { _packetLength = 0; }
+  if (_packetLength < SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH) { _packet[_packetLength ++] = data; }
+  
+  // a packet is complete when it has the length of its command
+  if (_packetLength >= 2)
+  {
+    boolean crc = (_packet[0] & 0x70) == 0x70;
+    byte length = _packet[1] == SABERTOOTH_CMD_GET ? (crc ? 8 : 7) : (crc ? 10 : 9);
+    if (_packetLength == length) { packet(_txFree); _packetLength = 0; }
+  }
+  return 1;
+}
+
+void USBSabertoothEmulator::packet(uint32_t arrival)
+{
+  USBSabertoothPacket packet;
+  USBSabertoothPacketDecoder::parse(_packet, _packetLength, &packet);
+  if (!packet.valid || packet.address < 128 || packet.address > 135)
+  {
+    _invalid ++; return;
+  }
+  _packets ++;
+  if (!(_addresses & (1 << (packet.address & 7)))) { return; }
+  
+  int16_t* values = _values[packet.address & 7];
+  byte output = (packet.type == 'P' ? 2 : 0) + (packet.number == 2 || packet.number == '2');
+  boolean outputNumber = packet.number == 1 || packet.number == '1' || packet.number == 2 || packet.number == '2';
+  
+  if (packet.command == SABERTOOTH_CMD_SET)
+  {
+    if ((packet.flags & ~1) == SABERTOOTH_SET_VALUE && outputNumber && (packet.type == 'M' || packet.type == 'P'))
+    {
+      values[output] = constrain(packet.value, -2047, 2047);
+    }
+  }
+  else if (packet.command == SABERTOOTH_CMD_GET)
+  {
+    int result = 0;
+    switch (packet.flags & ~3)
+    {
+    case SABERTOOTH_GET_VALUE:       result = outputNumber ? values[output] : 0; break;
+    case SABERTOOTH_GET_BATTERY:     result = _battery;     break;
+    case SABERTOOTH_GET_TEMPERATURE: result = _temperature; break;
+    case SABERTOOTH_GET_CURRENT:
+      result = (int)((int32_t)abs(values[output]) * _fullCurrent / 2047); break;
+    }
+    
+    byte flags = packet.flags & ~1;
+    if (result < 0) { result = -result; flags |= 1; }
+    byte data[5] = { flags, (byte)(result & 0x7f), (byte)((result >> 7) & 0x7f), packet.type, packet.number };
+    byte buffer[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+    size_t length = USBSabertoothCommandWriter::writeToBuffer(buffer, packet.address, (USBSabertoothCommand)SABERTOOTH_RC_GET,
+                                                               packet.crc, data, sizeof(data));
+    reply(arrival, buffer, length);
+  }
+}
+
+void USBSabertoothEmulator::reply(uint32_t arrival, const byte* data, size_t length)
+{
+  // replies start after the turnaround, a driver waits for its own previous reply to be out,
+  // but knows nothing of the others: two of them talking at once garble each other
+  uint32_t time = arrival + _turnaroundMicros;
+  if (USBSabertoothTimeout::later(_rxFree, time))
+  {
+    if (data[0] != _rxAddress && _queueLength)
+    {
+      byte last = (_queueStart + _queueLength - 1) % SABERTOOTH_EMULATOR_QUEUE_LENGTH;
+      _queue[last] ^= 0x01;
+      _rxBusyMicros += _byteMicros * length;
+      _collisions ++; return;
+    }
+    time = _rxFree;
+  }
+  _rxAddress = data[0];
+  for (size_t i = 0; i < length && _queueLength < SABERTOOTH_EMULATOR_QUEUE_LENGTH; i ++)
+  {
+    time += _byteMicros; _rxBusyMicros += _byteMicros;
+    byte slot = (_queueStart + _queueLength ++) % SABERTOOTH_EMULATOR_QUEUE_LENGTH;
+    _queue[slot] = noise(data[i]); _queueTime[slot] = time;
+  }
+  _rxFree = time;
+}
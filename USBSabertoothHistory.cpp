@@ -0,0 +1,136 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+static inline uint32_t zigzag  (int32_t  value) { return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); }
+static inline int32_t  unzigzag(uint32_t value) { return (int32_t)(value >> 1) ^ -(int32_t)(value & 1); }
+
+USBSabertoothHistory::USBSabertoothHistory(byte* recent, size_t recentSize,
+                                           USBSabertoothBucket* buckets, byte bucketCount, uint16_t samplesPerBucket)
+  : _recent(recent), _recentSize(recentSize), _buckets(buckets), _bucketCount(buckets ? bucketCount : 0),
+    _samplesPerBucket(samplesPerBucket ? samplesPerBucket : 1)
+{
+  clear();
+}
+
+void USBSabertoothHistory::clear()
+{
+  _start = _used = 0; _samples = 0;
+  _bucketStart = _bucketsUsed = 0; _pending = 0;
+}
+
+uint32_t USBSabertoothHistory::varint(size_t* position) const
+{
+  uint32_t value = 0;
+  for (byte shift = 0; ; shift += 7)
+  {
+    byte data = at((*position) ++);
+    value |= (uint32_t)(data & 0x7f) << shift;
+    if (!(data & 0x80)) { return value; }
+  }
+}
+
+void USBSabertoothHistory::put(uint32_t value)
+{
+  do
+  {
+    byte data = value & 0x7f; value >>= 7;
+    _recent[(_start + _used ++) % _recentSize] = value ? data | 0x80 : data;
+  }
+  while (value);
+}
+
+void USBSabertoothHistory::dropOldest()
+{
+  // the second oldest value becomes the one stored in full
+  size_t position = 0;
+  _first.time  += varint(&position);
+  _first.value += unzigzag(varint(&position));
+  _start = (_start + position) % _recentSize; _used -= position;
+  _samples --;
+}
+
+void USBSabertoothHistory::add(int value, uint32_t time)
+{
+  // summarize into the current bucket
+  if (_bucketCount)
+  {
+    if (_pending == 0) { _current.time = time; _current.min = _current.max = value; _sum = 0; }
+    if (value < _current.min) { _current.min = value; }
+    if (value > _current.max) { _current.max = value; }
+    _sum += value;
+    
+    if (++ _pending == _samplesPerBucket)
+    {
+      _current.avg = _sum / (int32_t)_samplesPerBucket;
+      _buckets[(_bucketStart + _bucketsUsed) % _bucketCount] = _current;
+      if (_bucketsUsed < _bucketCount) { _bucketsUsed ++; }
+      else                             { _bucketStart = (_bucketStart + 1) % _bucketCount; }
+      _pending = 0;
+    }
+  }
+  
+  // the oldest value is kept in full, every later one as deltas from its predecessor
+  if (_samples == 0)
+  {
+    _first.time = _last.time = time; _first.value = _last.value = value;
+    _samples = 1;
+    return;
+  }
+  
+  const size_t longest = 5 + 3;   // a 32 bit and a 17 bit varint
+  while (_samples > 1 && _recentSize - _used < longest) { dropOldest(); }
+  if (_recentSize - _used < longest) { return; }
+  
+  put(time - _last.time);
+  put(zigzag((int32_t)value - _last.value));
+  _last.time = time; _last.value = value;
+  _samples ++;
+}
+
+void USBSabertoothHistory::begin(USBSabertoothHistoryIterator* iterator) const
+{
+  iterator->position = 0;
+  iterator->index    = 0;
+  iterator->time     = _first.time;
+  iterator->value    = _first.value;
+}
+
+boolean USBSabertoothHistory::next(USBSabertoothHistoryIterator* iterator, USBSabertoothSample* sample) const
+{
+  if (iterator->index >= _samples) { return false; }
+  
+  if (iterator->index > 0)
+  {
+    iterator->time  += varint(&iterator->position);
+    iterator->value += unzigzag(varint(&iterator->position));
+  }
+  iterator->index ++;
+  
+  sample->time  = iterator->time;
+  sample->value = iterator->value;
+  return true;
+}
+
+boolean USBSabertoothHistory::bucket(byte index, USBSabertoothBucket* bucket) const
+{
+  if (index >= _bucketsUsed) { return false; }
+  *bucket = _buckets[(_bucketStart + index) % _bucketCount];
+  return true;
+}
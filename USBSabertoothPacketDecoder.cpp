@@ -0,0 +1,190 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+#if !defined(__AVR__)
+#define SABERTOOTH_WIDE_SCAN 1
+#endif
+
+// returns the index of the first header byte at or after i, or length
+static size_t findHeader(const byte* data, size_t i, size_t length)
+{
+#if SABERTOOTH_WIDE_SCAN
+  // test eight bytes at a time for a high bit
+  for (; i + 8 <= length; i += 8)
+  {
+    uint64_t word; memcpy(&word, data + i, 8);
+    if (word & 0x8080808080808080ULL) { break; }
+  }
+#endif
+  for (; i < length; i ++) { if (data[i] & 0x80) { return i; } }
+  return length;
+}
+
+USBSabertoothPacketDecoder::USBSabertoothPacketDecoder(USBSabertoothPacketHandler handler, void* user)
+  : _handler(handler), _user(user)
+{
+  reset();
+}
+
+void USBSabertoothPacketDecoder::reset()
+{
+  memset(_stats, 0, sizeof(_stats));
+  _skipped = 0; _partialLength = 0;
+}
+
+void USBSabertoothPacketDecoder::decode(const byte* data, size_t length)
+{
+  size_t i = 0;
+  
+  if (_partialLength)
+  {
+    // complete the packet carried over from the previous buffer,
+    // counting but not storing bytes past the longest valid packet
+    for (; i < length && !(data[i] & 0x80); i ++)
+    {
+      if (_partialLength < SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH) { _partial[_partialLength] = data[i]; }
+      if (_partialLength <= SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH) { _partialLength ++; }
+    }
+    if (i == length) { return; }
+    finish();
+  }
+  else
+  {
+    size_t header = findHeader(data, 0, length);
+    _skipped += header; i = header;
+  }
+  
+  while (i < length)
+  {
+    size_t next = findHeader(data, i + 1, length);
+    if (next == length)
+    {
+      // the packet may continue in the next buffer
+      size_t rest = length - i;
+      memcpy(_partial, data + i, rest < SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH ? rest : SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH);
+      _partialLength = rest > SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH ? SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH + 1 : rest;
+      return;
+    }
+    emit(data + i, next - i);
+    i = next;
+  }
+}
+
+void USBSabertoothPacketDecoder::finish()
+{
+  if (_partialLength) { emit(_partial, _partialLength); }
+  _partialLength = 0;
+}
+
+void USBSabertoothPacketDecoder::emit(const byte* bytes, size_t length)
+{
+  USBSabertoothPacket packet;
+  parse(bytes, length, &packet);
+  
+  USBSabertoothAddressStats& stats = _stats[packet.address & 7];
+  if (!packet.valid) { stats.invalid ++; }
+  else if (packet.command == SABERTOOTH_CMD_SET) { stats.sets    ++; }
+  else if (packet.command == SABERTOOTH_CMD_GET) { stats.gets    ++; }
+  else if (packet.command == SABERTOOTH_RC_GET ) { stats.replies ++; }
+  else                                           { stats.other   ++; }
+  
+  if (_handler) { _handler(packet, _user); }
+}
+
+void USBSabertoothPacketDecoder::parse(const byte* bytes, size_t length, USBSabertoothPacket* packet)
+{
+  memset(packet, 0, sizeof(*packet));
+  packet->bytes  = bytes;
+  packet->length = length > 255 ? 255 : (byte)length;
+  if (length < 4 || length > SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH) { packet->address = bytes[0] & ~0x70; return; }
+  
+  boolean crc = (bytes[0] & 0x70) == 0x70;
+  packet->address = crc ? bytes[0] & ~0x70 : bytes[0];
+  packet->command = bytes[1];
+  packet->crc     = crc;
+  packet->flags   = bytes[2];
+  
+  // the header is followed by a block of data bytes unless the command has a single data byte
+  boolean valid = crc ? USBSabertoothCRC7    ::value(bytes, 3) == bytes[3]
+                      : USBSabertoothChecksum::value(bytes, 3) == bytes[3];
+  if (length > 4)
+  {
+    if (length < (crc ? 7U : 6U)) { return; }
+    size_t dataLength = length - 4 - (crc ? 2 : 1);
+    if (crc)
+    {
+      uint16_t value = USBSabertoothCRC14::value(bytes + 4, dataLength);
+      valid = valid && ((value >> 0) & 0x7f) == bytes[length - 2]
+                    && ((value >> 7) & 0x7f) == bytes[length - 1];
+    }
+    else
+    {
+      valid = valid && USBSabertoothChecksum::value(bytes + 4, dataLength) == bytes[length - 1];
+    }
+    
+    switch (packet->command)
+    {
+    case SABERTOOTH_CMD_SET:
+    case SABERTOOTH_RC_GET:
+      valid = valid && dataLength == 4;
+      if (dataLength == 4)
+      {
+        int value = (int)((uint16_t)bytes[4] << 0 | (uint16_t)bytes[5] << 7);
+        packet->value  = (bytes[2] & 1) ? -value : value;
+        packet->type   = bytes[6];
+        packet->number = bytes[7];
+      }
+      break;
+      
+    case SABERTOOTH_CMD_GET:
+      valid = valid && dataLength == 2;
+      packet->type   = bytes[4];
+      packet->number = bytes[5];
+      break;
+    }
+  }
+  packet->valid = valid;
+}
+
+void USBSabertoothPacketDecoder::printCSV(Print& out, const USBSabertoothPacket& packet)
+{
+  out.print((int)packet.address); out.print(',');
+  out.print((int)packet.command); out.print(',');
+  out.print((int)packet.crc    ); out.print(',');
+  out.print((int)packet.valid  ); out.print(',');
+  out.print((int)packet.flags  ); out.print(',');
+  out.print((int)packet.type   ); out.print(',');
+  out.print((int)packet.number ); out.print(',');
+  out.print(packet.value); out.println();
+}
+
+void USBSabertoothPacketDecoder::printStats(Print& out) const
+{
+  for (byte i = 0; i < 8; i ++)
+  {
+    const USBSabertoothAddressStats& stats = _stats[i];
+    out.print(128 + i);      out.print(',');
+    out.print(stats.sets   ); out.print(',');
+    out.print(stats.gets   ); out.print(',');
+    out.print(stats.replies); out.print(',');
+    out.print(stats.other  ); out.print(',');
+    out.print(stats.invalid); out.println();
+  }
+}
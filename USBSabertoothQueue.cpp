@@ -0,0 +1,95 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+USBSabertoothQueue::USBSabertoothQueue(USBSabertoothSerial& serial)
+  : _serial(serial), _busy(false), _done(false)
+{}
+
+boolean USBSabertoothQueue::submitSet(const USBSabertooth& driver, byte type, byte number, int value,
+                                      USBSabertoothSetType setType)
+{
+  USBSabertoothOperation operation;
+  operation.address = driver.address();
+  operation.command = SABERTOOTH_CMD_SET;
+  operation.flags   = (byte)setType;
+  operation.type    = type;
+  operation.number  = number;
+  operation.crc     = driver.usingCRC();
+  operation.value   = value;
+  operation.context = 0;
+  return _sets.push(operation);
+}
+
+boolean USBSabertoothQueue::submitGet(const USBSabertooth& driver, byte type, byte number,
+                                      USBSabertoothGetType getType, int context, boolean unscaled)
+{
+  USBSabertoothOperation operation;
+  operation.address = driver.address();
+  operation.command = SABERTOOTH_CMD_GET;
+  operation.flags   = (byte)getType | (unscaled ? 2 : 0);
+  operation.type    = type;
+  operation.number  = number;
+  operation.crc     = driver.usingCRC();
+  operation.value   = 0;
+  operation.context = context;
+  return _gets.push(operation);
+}
+
+void USBSabertoothQueue::service()
+{
+  // sets go straight out, they never wait for a reply
+  USBSabertoothOperation operation;
+  while ( _sets.pop(&operation) )
+  {
+    _serial.set( operation.address, operation.crc, operation.type, operation.number,
+                 operation.value, (USBSabertoothSetType)operation.flags );
+  }
+  
+  // collect the reply of the get in flight, if any
+  if ( _busy && !_done )
+  {
+    int result, context;
+    if ( _serial.reply_available( &result, &context ) )
+    {
+      _current.value = result;
+      if ( result == SABERTOOTH_GET_ERROR || result == SABERTOOTH_GET_TIMED_OUT ) { _current.context = result; }
+      _done = true;
+    }
+  }
+  
+  // a completed get is held here until the application makes room for it
+  if ( _done )
+  {
+    if ( !_completions.push(_current) ) { return; }
+    _busy = _done = false;
+  }
+  
+  // one get in flight at a time
+  if ( !_busy && _gets.peek(&operation) )
+  {
+    if ( !_serial.async_get( operation.address, operation.crc, operation.type, operation.number,
+                             (USBSabertoothGetType)(operation.flags & ~2), operation.context, operation.flags & 2 ) )
+    {
+      return;   // someone else is using the serial for a get, try again later
+    }
+    _current = operation; _busy = true;
+    _gets.pop(&operation);
+  }
+}
@@ -0,0 +1,91 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+USBSabertoothReplay::USBSabertoothReplay(const USBSabertoothCapture& capture, boolean realTime)
+  : _capture(capture), _realTime(realTime)
+{
+  rewind();
+}
+
+void USBSabertoothReplay::rewind()
+{
+  _rxPosition = _txPosition = 0;
+  _rxIndex = _rx.length = 0;
+  _txIndex = _tx.length = 0;
+  _mismatches = 0;
+  
+  // the timing of the first record is the playback origin
+  USBSabertoothCaptureRecord first; size_t position = 0;
+  _first = _capture.read(&position, &first) ? first.time : 0;
+  _start = USBSabertoothTimeout::now();
+}
+
+boolean USBSabertoothReplay::next(size_t* position, byte direction, USBSabertoothCaptureRecord* record)
+{
+  while (_capture.read(position, record))
+  {
+    if (record->direction == direction) { return true; }
+  }
+  record->length = 0;
+  return false;
+}
+
+boolean USBSabertoothReplay::due()
+{
+  if (_rxIndex >= _rx.length)
+  {
+    if (!next(&_rxPosition, SABERTOOTH_CAPTURE_RX, &_rx)) { return false; }
+    _rxIndex = 0;
+  }
+  return !_realTime || USBSabertoothTimeout::now() - _start >= _rx.time - _first;
+}
+
+boolean USBSabertoothReplay::finished()
+{
+  if (_rxIndex < _rx.length) { return false; }
+  size_t position = _rxPosition; USBSabertoothCaptureRecord record;
+  return !next(&position, SABERTOOTH_CAPTURE_RX, &record);
+}
+
+int USBSabertoothReplay::available()
+{
+  return due() ? _rx.length - _rxIndex : 0;
+}
+
+int USBSabertoothReplay::read()
+{
+  return due() ? _rx.data[_rxIndex ++] : -1;
+}
+
+int USBSabertoothReplay::peek()
+{
+  return due() ? _rx.data[_rxIndex] : -1;
+}
+
+size_t USBSabertoothReplay::write(uint8_t data)
+{
+  if (_txIndex >= _tx.length)
+  {
+    _txIndex = 0;
+    if (!next(&_txPosition, SABERTOOTH_CAPTURE_TX, &_tx)) { _mismatches ++; return 1; }
+  }
+  if (_tx.data[_txIndex ++] != data) { _mismatches ++; }
+  return 1;
+}
@@ -25,12 +25,20 @@ USBSabertoothReplyReceiver::USBSabertoothReplyReceiver()
 
 void USBSabertoothReplyReceiver::read(byte data)
 {
-  //if (data >= 128 || _ready) { reset(); }
-  if (_length < SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH) { _data[_length ++] = data; }
+  // a complete reply is kept until the caller took it and reset the receiver
+  if (_ready) { return; }
   
-  if (_length >= 9 && _data[0] >= 128)
+  // only header bytes have their high bit set, so one always starts a new packet and
+  // anything else is dropped until it does: a broken packet never holds up the next one
+  if (data & 0x80) { reset(); }
+  else if (_length == 0) { return; }
+  
+  _data[_length ++] = data;
+  
+  if (_length >= 9)
   {
-    boolean crc = (_data[0] & 0x70) == 0x70; size_t length;
+    boolean crc = (_data[0] & 0x70) == 0x70; byte length;
+    if (crc != SABERTOOTH_USE_CRC(crc)) { reset(); return; }   // integrity mode compiled out
     
     switch (_data[1])
     {
@@ -38,7 +46,7 @@ void USBSabertoothReplyReceiver::read(byte data)
       length = crc ? 10 : 9; break;
     
     default:
-      return;
+      reset(); return;
     }
     
     if (_length == length)
@@ -54,6 +62,7 @@ void USBSabertoothReplyReceiver::read(byte data)
           {
             _data[0] &= ~0x70;
             _ready = true; _usingCRC = true;
+            SABERTOOTH_TRACE_MARK(SABERTOOTH_TRACE_FRAME, _data[0], _data[1]);
           }
         }
       }
@@ -64,9 +73,12 @@ void USBSabertoothReplyReceiver::read(byte data)
           if (USBSabertoothChecksum::value(_data + 4, length - 5) == _data[length - 1])
           {
             _ready = true; _usingCRC = false;
+            SABERTOOTH_TRACE_MARK(SABERTOOTH_TRACE_FRAME, _data[0], _data[1]);
           }
         }
       }
+      
+      if (!_ready) { _length = 0; }   // corrupt, wait for the next header
     }
   }
 }
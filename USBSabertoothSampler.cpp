@@ -0,0 +1,158 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+USBSabertoothSampler::USBSabertoothSampler(USBSabertoothSerial& serial)
+  : _serial(serial), _count(0), _current(0), _busy(false), _polls(0), _baseline(0), _errors(0)
+{
+  configure(SABERTOOTH_GET_VALUE,         20,  1000, 16);
+  configure(SABERTOOTH_GET_BATTERY,      500, 10000,  2);
+  configure(SABERTOOTH_GET_CURRENT,       20,  1000,  4);
+  configure(SABERTOOTH_GET_TEMPERATURE,  500, 10000,  1);
+}
+
+byte USBSabertoothSampler::configIndex(byte getType)
+{
+  switch (getType)
+  {
+  case SABERTOOTH_GET_BATTERY:     return 1;
+  case SABERTOOTH_GET_CURRENT:     return 2;
+  case SABERTOOTH_GET_TEMPERATURE: return 3;
+  default:                         return 0;
+  }
+}
+
+void USBSabertoothSampler::configure(USBSabertoothGetType getType, int32_t fastestMS, int32_t slowestMS, int threshold)
+{
+  Config& config = _configs[configIndex(getType)];
+  
+  // the same limit as USBSabertoothTimeout keeps intervals within a tick count
+  int32_t fastest = USBSabertoothTimeout::ticksFromMS(fastestMS), slowest = USBSabertoothTimeout::ticksFromMS(slowestMS);
+  fastest = constrain(fastest, 1, SABERTOOTH_MAX_INTERVAL);
+  slowest = constrain(slowest, fastest, SABERTOOTH_MAX_INTERVAL);
+  
+  config.fastest = (USBSabertoothTicks)fastest;
+  config.slowest = (USBSabertoothTicks)slowest;
+  config.threshold = threshold;
+}
+
+int USBSabertoothSampler::add(USBSabertooth& driver, USBSabertoothGetType getType, byte number)
+{
+  if (_count >= SABERTOOTH_SAMPLER_CHANNELS) { return -1; }
+  
+  Channel& channel = _channels[_count];
+  channel.driver = &driver;
+  channel.getType = getType;
+  channel.number = number;
+  channel.value = 0;
+  channel.setpoints[0] = channel.setpoints[1] = 0;
+  channel.interval = _configs[configIndex(getType)].fastest;
+  channel.due = channel.polled = (USBSabertoothTicks)USBSabertoothTimeout::now();
+  channel.valid = false;
+  return _count ++;
+}
+
+void USBSabertoothSampler::setpoint(const USBSabertooth& driver, byte number, int value)
+{
+  for (byte i = 0; i < _count; i ++)
+  {
+    Channel& channel = _channels[i];
+    if (channel.driver != &driver) { continue; }
+    
+    byte slot;
+    if      (number == 'T')                                                          { slot = 1; }
+    else if (number == 'D' || number == channel.number || number == channel.number + '0') { slot = 0; }
+    else                                                                             { continue; }
+    
+    if (channel.setpoints[slot] == value) { continue; }
+    channel.setpoints[slot] = value;
+    channel.interval = _configs[configIndex(channel.getType)].fastest;
+    USBSabertoothTicks now = (USBSabertoothTicks)USBSabertoothTimeout::now();
+    if (USBSabertoothTimeout::later(channel.due, now)) { channel.due = now; }   // an overdue channel keeps its place
+  }
+}
+
+void USBSabertoothSampler::reading(Channel& channel, int result)
+{
+  const Config& config = _configs[configIndex(channel.getType)];
+  
+  // moving readings are sampled twice as often, stable ones a quarter less often each time
+  if (!channel.valid || abs(result - channel.value) > config.threshold)
+  {
+    channel.interval = channel.interval / 2 > config.fastest ? channel.interval / 2 : config.fastest;
+  }
+  else
+  {
+    uint32_t interval = (uint32_t)channel.interval + channel.interval / 4 + 1;
+    channel.interval = interval < config.slowest ? (USBSabertoothTicks)interval : config.slowest;
+  }
+  channel.value = result;
+  channel.valid = true;
+}
+
+boolean USBSabertoothSampler::run(byte* channel)
+{
+  USBSabertoothTicks now = (USBSabertoothTicks)USBSabertoothTimeout::now();
+  
+  if (_busy)
+  {
+    int result, context;
+    if (!_serial.reply_available(&result, &context)) { return false; }
+    _busy = false;
+    
+    Channel& current = _channels[_current];
+    if (result == SABERTOOTH_GET_TIMED_OUT || result == SABERTOOTH_GET_ERROR) { current.due = now + current.interval; _errors ++; return false; }
+    
+    reading(current, result);
+    current.due = now + current.interval;
+    *channel = _current;
+    return true;
+  }
+  
+  // the channel most overdue goes first
+  int best = -1;
+  for (byte i = 0; i < _count; i ++)
+  {
+    if (USBSabertoothTimeout::later(_channels[i].due, now)) { continue; }
+    if (best < 0 || USBSabertoothTimeout::later(_channels[best].due, _channels[i].due)) { best = i; }
+  }
+  if (best < 0) { return false; }
+  
+  Channel& next = _channels[best];
+  boolean accepted;
+  switch (next.getType)
+  {
+  case SABERTOOTH_GET_BATTERY:     accepted = next.driver->async_getBattery    (next.number, best); break;
+  case SABERTOOTH_GET_CURRENT:     accepted = next.driver->async_getCurrent    (next.number, best); break;
+  case SABERTOOTH_GET_TEMPERATURE: accepted = next.driver->async_getTemperature(next.number, best); break;
+  default:                         accepted = next.driver->async_get      ('M', next.number, best); break;
+  }
+  if (!accepted) { return false; }
+  
+  // a fixed poll would have sent a get every fastest interval since the last one
+  USBSabertoothTicks fastest = _configs[configIndex(next.getType)].fastest;
+  uint32_t missed = (USBSabertoothTicks)(now - next.polled) / fastest;
+  _baseline += missed ? missed : 1;
+  _polls ++;
+  
+  next.polled = now;
+  _current = best;
+  _busy = true;
+  return false;
+}
@@ -0,0 +1,121 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+USBSabertoothScriptPlayer::USBSabertoothScriptPlayer(USBSabertoothSerial& serial)
+  : _serial(serial), _script(NULL), _source(NULL), _length(0), _position(0), _due(0), _cycleDue(0),
+    _sent(0), _maxLate(0), _recordLength(0), _packetLength(0), _progmem(false), _loop(false),
+    _playing(false), _ready(false)
+{}
+
+void USBSabertoothScriptPlayer::play(const byte* script, size_t length, boolean progmem, boolean loop)
+{
+  _script = script; _source = NULL;
+  _length = length; _progmem = progmem; _loop = loop;
+  _position = 0; _recordLength = 0;
+  _due = _cycleDue = USBSabertoothTimeout::now();
+  _sent = _maxLate = 0;
+  _ready = false;
+  _playing = length >= SABERTOOTH_SCRIPT_RECORD_LENGTH;
+  if (_playing) { fetch(); }
+}
+
+void USBSabertoothScriptPlayer::play(Stream& source)
+{
+  _script = NULL; _source = &source;
+  _length = 0; _progmem = false; _loop = false;
+  _position = 0; _recordLength = 0;
+  _due = _cycleDue = USBSabertoothTimeout::now();
+  _sent = _maxLate = 0;
+  _ready = false;
+  _playing = true;
+  fetch();
+}
+
+void USBSabertoothScriptPlayer::stop()
+{
+  _playing = _ready = false;
+}
+
+boolean USBSabertoothScriptPlayer::fetch()
+{
+  if (_ready) { return true; }
+  
+  // gather a record, a stream may hand it over a few bytes at a time
+  if (_source)
+  {
+    for (int value; _recordLength < SABERTOOTH_SCRIPT_RECORD_LENGTH && (value = _source->read()) >= 0; )
+    {
+      _record[_recordLength ++] = (byte)value;
+    }
+    if (_recordLength < SABERTOOTH_SCRIPT_RECORD_LENGTH) { return false; }
+  }
+  else if (_position + SABERTOOTH_SCRIPT_RECORD_LENGTH <= _length)
+  {
+    for (byte i = 0; i < SABERTOOTH_SCRIPT_RECORD_LENGTH; i ++)
+    {
+      const byte* data = _script + _position ++;
+      _record[i] = _progmem ? pgm_read_byte(data) : *data;
+    }
+  }
+  else
+  {
+    memset(_record, 0, sizeof(_record));   // the end of the script is an end record
+  }
+  _recordLength = 0;
+  
+  uint16_t delayMS = (uint16_t)_record[0] | (uint16_t)_record[1] << 8;
+  byte     address = _record[2], flags = _record[3];
+  int      value   = (int16_t)((uint16_t)_record[6] | (uint16_t)_record[7] << 8);
+  _due += (uint32_t)delayMS * SABERTOOTH_TICKS_PER_MS;
+  
+  // the packet is ready well before it is due, an empty one ends the script
+  _packetLength = address ? (byte)USBSabertoothSerial::encodeSet(_packet, address, !(flags & SABERTOOTH_SCRIPT_CHECKSUM),
+                                                               _record[4], _record[5], value,
+                                                               (USBSabertoothSetType)(flags & ~SABERTOOTH_SCRIPT_CHECKSUM))
+                          : 0;
+  _ready = true;
+  return true;
+}
+
+boolean USBSabertoothScriptPlayer::run()
+{
+  while (_playing && fetch())
+  {
+    uint32_t late = USBSabertoothTimeout::now() - _due;
+    if ((int32_t)late < 0) { break; }
+    _ready = false;
+    
+    if (_packetLength)
+    {
+      _serial.writePacket(_packet, _packetLength);
+      if (late > _maxLate) { _maxLate = late; }
+      _sent ++;
+    }
+    else if (_loop && _due != _cycleDue)   // a loop that takes no time would never return
+    {
+      _position = 0; _cycleDue = _due;
+    }
+    else
+    {
+      _playing = false;
+    }
+  }
+  return _playing;
+}
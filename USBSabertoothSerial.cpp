@@ -23,39 +23,130 @@ Updated by John Lluch
 #include "USBSabertooth_NB.h"
 
 USBSabertoothSerial::USBSabertoothSerial(Stream& port)
-  : _port(port), _poll(SABERTOOTH_DEFAULT_GET_POLL_INTERVAL)
+  : _port(port), _poll(SABERTOOTH_DEFAULT_GET_POLL_INTERVAL), _capture(NULL), _sweep(NULL),
+    _budgetBytes(0), _budgetTicks(0), _clearing(false), _idle(false), _resume(false)
 {
   setGetTimeout(SABERTOOTH_DEFAULT_GET_TIMEOUT);
   _poll.expire();
 }
 
-void USBSabertoothSerial::clearSerial()
+void USBSabertoothSerial::setBudget(uint16_t maxBytes, uint16_t maxTicks)
 {
-  while( !( _port.read() < 0) );
+  _budgetBytes = maxBytes; _budgetTicks = maxTicks;
+}
+
+boolean USBSabertoothSerial::withinBudget(uint16_t bytes, USBSabertoothTicks start) const
+{
+  if (_budgetBytes && bytes >= _budgetBytes) { return false; }
+  if (_budgetTicks && (USBSabertoothTicks)(USBSabertoothTimeout::now() - start) >= _budgetTicks) { return false; }
+  return true;
+}
+
+int32_t USBSabertoothSerial::ticksUntilDue() const
+{
+  if ( _clearing || _resume || _receiver.ready() ) { return 0; }
+  if ( _request.pending() )                         { return _request.remaining(); }
+  if ( _idle )                                      { return SABERTOOTH_INFINITE_TIMEOUT; }
+  
+  int32_t poll = _poll.remaining(), deadline = _request.deadlineRemaining();
+  return poll < 0 || (deadline >= 0 && deadline < poll) ? deadline : poll;
+}
+
+boolean USBSabertoothSerial::setDeadlineTicks(int context, int32_t ticks)
+{
+  if ( _idle || _request.cancelled() || _request.context != context ) { return false; }
+  _request.setDeadlineTicks(ticks);
+  return true;
+}
+
+boolean USBSabertoothSerial::cancel(int context)
+{
+  if ( _idle || _request.cancelled() || _request.context != context ) { return false; }
+  
+  // a get on the line is still answered, its reply is discarded when it comes
+  if ( _request.pending() ) { _request.cancel(); }
+  _request.clearDeadline();
+  _sweep = NULL;
+  _idle = true;
+  _resume = false;
+  return true;
+}
+
+boolean USBSabertoothSerial::clearSerial()
+{
+  USBSabertoothTicks start = (USBSabertoothTicks)USBSabertoothTimeout::now();
+  for (uint16_t bytes = 0; withinBudget(bytes, start); bytes ++)
+  {
+    if (_port.read() < 0) { _clearing = false; return true; }
+  }
+  _clearing = true;   // out of budget, carry on with the next call
+  return false;
 }
 
 boolean USBSabertoothSerial::tryReceivePacket()
 {  
-  while ( !_receiver.ready() )    // do not attempt to read any further bytes unless the reveiver is reset
+  USBSabertoothTicks start = (USBSabertoothTicks)USBSabertoothTimeout::now();
+  uint16_t bytes = 0;
+  for (; !_receiver.ready(); bytes ++)    // do not attempt to read any further bytes unless the reveiver is reset
   {
+    if (!withinBudget(bytes, start)) { break; }
+    
     int value = _port.read();
-    if (value < 0) { return false; }
+    if (value < 0) { break; }
 
-    _receiver.read((byte)value);
+    byte data = (byte)value;
+    receive(&data, 1);
   }
-  return true;
+  if (bytes) { SABERTOOTH_TRACE_SPAN(SABERTOOTH_TRACE_READ, start, bytes, _receiver.ready()); }
+  return _receiver.ready();
+}
+
+size_t USBSabertoothSerial::receive(const byte* data, size_t length)
+{
+  if ( !_request.pending() ) { return length; }   // nobody is waiting for these bytes
+  
+  size_t i = 0;
+  while ( i < length && !_receiver.ready() )
+  {
+    _receiver.read(data[i ++]);
+    if (_receiver.ready() && _capture) { captureReply(_receiver); }
+  }
+  return i;
+}
+
+void USBSabertoothSerial::captureReply(const USBSabertoothReplyReceiver& receiver)
+{
+  byte packet[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+  size_t length = receiver.usingCRC() ? 10 : 9;
+  memcpy(packet, receiver.data(), length);
+  if (receiver.usingCRC()) { packet[0] |= 0x70; }   // undo the receiver's address fixup
+  _capture->record(SABERTOOTH_CAPTURE_RX, packet, length);
 }
 
 void USBSabertoothSerial::write( byte address, USBSabertoothCommand command, boolean useCRC,
                                                const byte* data, size_t lengthOfData)
 {
   byte buffer[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
-  size_t lengthOfBuffer = USBSabertoothCommandWriter::writeToBuffer(buffer, address, command, useCRC, data, lengthOfData);
-  _port.write(buffer, lengthOfBuffer);
+  writePacket(buffer, USBSabertoothCommandWriter::writeToBuffer(buffer, address, command, useCRC, data, lengthOfData));
+}
+
+void USBSabertoothSerial::writePacket(const byte* buffer, size_t length)
+{
+  SABERTOOTH_TRACE_START(start);
+  _port.write(buffer, length);
+  SABERTOOTH_TRACE_SPAN(SABERTOOTH_TRACE_WRITE, start, buffer[0] & ~0x70, buffer[1]);   // undo the CRC address bits
+  if (_capture) { _capture->record(SABERTOOTH_CAPTURE_TX, buffer, length); }
 }
 
 void USBSabertoothSerial::set(byte address, boolean useCrc, byte type, byte number, 
                     int value, USBSabertoothSetType setType)
+{
+  byte buffer[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+  writePacket(buffer, encodeSet(buffer, address, useCrc, type, number, value, setType));
+}
+
+size_t USBSabertoothSerial::encodeSet(byte* buffer, byte address, boolean useCrc, byte type, byte number, 
+                    int value, USBSabertoothSetType setType)
 {
   byte flags = (byte)setType;
   if (value < -SABERTOOTH_MAX_VALUE) { value = -SABERTOOTH_MAX_VALUE; }
@@ -69,9 +160,10 @@ void USBSabertoothSerial::set(byte address, boolean useCrc, byte type, byte numb
   commandData[3] = type;
   commandData[4] = number;
   
-  write( address, SABERTOOTH_CMD_SET, useCrc, commandData, sizeof(commandData)); 
+  return USBSabertoothCommandWriter::writeToBuffer( buffer, address, SABERTOOTH_CMD_SET, useCrc, commandData, sizeof(commandData) );
 }
 
+#if !SABERTOOTH_NO_SYNC_GET
 int USBSabertoothSerial::get(byte address, boolean useCrc, byte type, byte number,
                        USBSabertoothGetType getType, boolean unscaled)
 {  
@@ -86,14 +178,89 @@ int USBSabertoothSerial::get(byte address, boolean useCrc, byte type, byte numbe
 
   return result;   
 }
+#endif
 
 boolean USBSabertoothSerial::async_get(byte address, boolean useCrc, byte type, byte number,
                        USBSabertoothGetType getType, int context, boolean unscaled)
 {
-  // we will not accept any new get command until the previous one is completed
-  if ( _request.pending() )  
+  // we will not accept any new get command until the previous one, or the sweep, is completed
+  if ( _request.pending() || _sweep )  
+    return false;
+  
+  prepareRequest( address, useCrc, type, number, getType, context, unscaled );
+  _request.clearDeadline();
+
+  // if user has polling disabled send the command right now 
+  if ( !_poll.canExpire() )  
+    sendRequest();
+
+  // we accepted the request, so return true
+  return true;
+}
+
+// telemetry sweep fields, in the order they are requested
+static const byte sweepNumbers [SABERTOOTH_TELEMETRY_FIELDS] = { 1, 1, 2, 1, 2, 1, 2 };
+static const byte sweepGetTypes[SABERTOOTH_TELEMETRY_FIELDS] = 
+{
+  SABERTOOTH_GET_BATTERY, 
+  SABERTOOTH_GET_VALUE,   SABERTOOTH_GET_VALUE, 
+  SABERTOOTH_GET_CURRENT, SABERTOOTH_GET_CURRENT, 
+  SABERTOOTH_GET_TEMPERATURE, SABERTOOTH_GET_TEMPERATURE
+};
+
+boolean USBSabertoothSerial::async_sweep(byte address, boolean useCrc, USBSabertoothTelemetry* snapshot,
+                       byte fields, int context, boolean unscaled)
+{
+  fields &= SABERTOOTH_TELEMETRY_ALL;
+  if ( _request.pending() || _sweep || !fields )
     return false;
   
+  snapshot->valid = 0;
+  snapshot->_fields = fields;
+  snapshot->_field = 0;
+  snapshot->_address = address;
+  snapshot->_crc = SABERTOOTH_USE_CRC(useCrc);
+  snapshot->_unscaled = unscaled;
+  snapshot->_context = context;
+  _sweep = snapshot;
+  _request.clearDeadline();
+  
+  // the sweep waits for the poll interval like a single get, and then runs back to back
+  nextSweepRequest();
+  if ( !_poll.canExpire() )
+    sendRequest();
+  
+  return true;
+}
+
+boolean USBSabertoothSerial::nextSweepRequest()
+{
+  USBSabertoothTelemetry* sweep = _sweep;
+  while ( sweep->_field < SABERTOOTH_TELEMETRY_FIELDS && !(sweep->_fields & (1 << sweep->_field)) )
+    sweep->_field ++;
+    
+  if ( sweep->_field >= SABERTOOTH_TELEMETRY_FIELDS )
+    return false;
+    
+  prepareRequest( sweep->_address, sweep->_crc, 'M', sweepNumbers[sweep->_field], 
+                  (USBSabertoothGetType)sweepGetTypes[sweep->_field], sweep->_context, sweep->_unscaled );
+  return true;
+}
+
+void USBSabertoothSerial::finishSweep(int* result, int* context)
+{
+  // the sweep is reported once, nothing is polled again until the next get or sweep
+  USBSabertoothTelemetry* sweep = _sweep;
+  _sweep = NULL;
+  _idle = true;
+  sweep->time = USBSabertoothTimeout::now();
+  *result = sweep->valid;
+  *context = sweep->_context;
+}
+
+void USBSabertoothSerial::prepareRequest(byte address, boolean useCrc, byte type, byte number,
+                       USBSabertoothGetType getType, int context, boolean unscaled)
+{
   byte flags = (byte)getType;
   if (unscaled) { flags |= 2; }
 
@@ -105,17 +272,16 @@ boolean USBSabertoothSerial::async_get(byte address, boolean useCrc, byte type,
 
   _request.context = context;
   _request.address = address;
-  _request.crc = useCrc;
-
-  // if user has polling disabled send the command right now 
-  if ( !_poll.canExpire() )  
-  {
-    _request.reset();
-    write( address, SABERTOOTH_CMD_GET, useCrc, commandData, SABERTOOTH_GETCOMMAND_DATA_LENGTH );
-  }
+  _request.crc = SABERTOOTH_USE_CRC(useCrc);
+  _idle = false;
+  SABERTOOTH_TRACE_MARK(SABERTOOTH_TRACE_QUEUE, address, flags);
+}
 
-  // we accepted the request, so return true
-  return true;
+void USBSabertoothSerial::sendRequest()
+{
+  SABERTOOTH_TRACE_MARK(SABERTOOTH_TRACE_SEND, _request.address, _request.commandData[0]);
+  _request.reset();
+  write( _request.address, SABERTOOTH_CMD_GET, _request.crc, _request.commandData, SABERTOOTH_GETCOMMAND_DATA_LENGTH );
 }
 
 boolean USBSabertoothSerial::reply_available( byte *type, byte *number, USBSabertoothGetType *getType, int *result, int *context)
@@ -129,6 +295,17 @@ boolean USBSabertoothSerial::reply_available( byte *type, byte *number, USBSaber
   *number = commandData[2];
   *context = _request.context;
 
+  // a cancelled get is through once its reply, or its timeout, is
+  if ( _request.pending() && _request.cancelled() )
+  {
+    if ( _request.expired() || tryReceivePacket() )
+    {
+      _request.expire();
+      _receiver.reset();
+    }
+    return false;
+  }
+
   // check whether we have a pending request
   if ( _request.pending() )
   {
@@ -171,15 +348,61 @@ boolean USBSabertoothSerial::reply_available( byte *type, byte *number, USBSaber
     // we got a packet processed, stop the timeout timer, reset the receiver and return true
     _request.expire();
     _receiver.reset();
+    
+    // a sweep only reports once all of its gets are done, the next one is sent right away,
+    // or once the bytes of a bad reply are cleared
+    if ( _sweep )
+    {
+      USBSabertoothTelemetry* sweep = _sweep;
+      if ( *result != SABERTOOTH_GET_TIMED_OUT && *result != SABERTOOTH_GET_ERROR )
+      {
+        sweep->values[sweep->_field] = *result;
+        sweep->valid |= 1 << sweep->_field;
+      }
+      
+      sweep->_field ++;
+      if ( !_request.missedDeadline() && nextSweepRequest() )
+      {
+        if ( _clearing ) { _resume = true; } else { sendRequest(); }
+        return false;
+      }
+      finishSweep( result, context );
+    }
+    _request.clearDeadline();
+    SABERTOOTH_TRACE_MARK(SABERTOOTH_TRACE_REPLY, *result, *context);
+    return true;
+  }
+  
+  // finish discarding the bytes of a bad reply before anything new is sent
+  if ( _clearing && !clearSerial() )
+    return false;
+  
+  if ( _idle )
+    return false;
+  
+  // a get that missed its deadline before it was sent is dropped
+  if ( _request.missedDeadline() )
+  {
+    *result = *context = SABERTOOTH_GET_TIMED_OUT;
+    if ( _sweep ) { finishSweep( result, context ); }
+    _request.clearDeadline();
+    _idle = true;
+    _resume = false;
+    SABERTOOTH_TRACE_MARK(SABERTOOTH_TRACE_REPLY, *result, *context);
     return true;
   }
   
-  // there's not a pending request, it might be now the time to send the current one according to the poll interval
-  if ( _poll.expired() )
+  // there's not a pending request, it might be now the time to send the current one according to the poll interval;
+  // a sweep get held back while clearing goes out right away
+  if ( _resume )
+  {
+    _resume = false;
+    sendRequest();
+  }
+  else if ( _poll.expired() )
   {
     _poll.reset();
-    _request.reset();
-     write( _request.address, SABERTOOTH_CMD_GET, _request.crc, commandData, SABERTOOTH_GETCOMMAND_DATA_LENGTH );
+    sendRequest();
   }
 
   // we did not process a request this time, so return false
@@ -0,0 +1,84 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+USBSabertoothShadow::USBSabertoothShadow(int32_t refreshIntervalMS)
+  : _known(0), _next(0), _refresh(refreshIntervalMS)
+{}
+
+USBSabertoothShadowChannel USBSabertoothShadow::channel(byte type, byte number, USBSabertoothSetType setType)
+{
+  byte second;
+  switch (number)
+  {
+  case 1: case '1': second = 0; break;
+  case 2: case '2': second = 1; break;
+  case 'D':         second = 2; break;
+  case 'T':         second = 3; break;
+  default: return SABERTOOTH_SHADOW_CHANNELS;
+  }
+  
+  if (setType == SABERTOOTH_SET_SHUTDOWN)
+  {
+    if (second > 1) { return SABERTOOTH_SHADOW_CHANNELS; }
+    if (type == 'M') { return (USBSabertoothShadowChannel)(SABERTOOTH_SHADOW_SHUTDOWN_M1 + second); }
+    if (type == 'P') { return (USBSabertoothShadowChannel)(SABERTOOTH_SHADOW_SHUTDOWN_P1 + second); }
+    return SABERTOOTH_SHADOW_CHANNELS;
+  }
+  if (setType != SABERTOOTH_SET_VALUE) { return SABERTOOTH_SHADOW_CHANNELS; }
+  
+  if (type == 'M') { return (USBSabertoothShadowChannel)(SABERTOOTH_SHADOW_M1 + second); }
+  if (second > 1)  { return SABERTOOTH_SHADOW_CHANNELS; }
+  switch (type)
+  {
+  case 'P': return (USBSabertoothShadowChannel)(SABERTOOTH_SHADOW_P1 + second);
+  case 'Q': return (USBSabertoothShadowChannel)(SABERTOOTH_SHADOW_Q1 + second);
+  case 'R': return (USBSabertoothShadowChannel)(SABERTOOTH_SHADOW_R1 + second);
+  default:  return SABERTOOTH_SHADOW_CHANNELS;
+  }
+}
+
+void USBSabertoothShadow::record(USBSabertoothShadowChannel channel, int value)
+{
+  if (channel >= SABERTOOTH_SHADOW_CHANNELS) { return; }
+  _values[channel] = constrain(value, -SABERTOOTH_MAX_VALUE, SABERTOOTH_MAX_VALUE);
+  _known |= 1 << channel;
+  
+  // independent and mixed mode drive the same motors: the mode last used replaces the other,
+  // or a refresh would bring back a motor value the application has since overridden
+  const uint16_t independent = 1 << SABERTOOTH_SHADOW_M1 | 1 << SABERTOOTH_SHADOW_M2;
+  const uint16_t mixed       = 1 << SABERTOOTH_SHADOW_MD | 1 << SABERTOOTH_SHADOW_MT;
+  if ((1 << channel) & independent) { _known &= ~mixed; }
+  if ((1 << channel) & mixed)       { _known &= ~independent; }
+}
+
+boolean USBSabertoothShadow::nextRefresh(USBSabertoothShadowChannel* channel)
+{
+  if (!_known || !_refresh.expired()) { return false; }
+  _refresh.reset();
+  
+  // the next known channel after the last one refreshed
+  while (!known((USBSabertoothShadowChannel)_next))
+  {
+    _next = (_next + 1) % SABERTOOTH_SHADOW_CHANNELS;
+  }
+  *channel = (USBSabertoothShadowChannel)_next;
+  _next = (_next + 1) % SABERTOOTH_SHADOW_CHANNELS;
+  return true;
+}
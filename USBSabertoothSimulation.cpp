@@ -0,0 +1,104 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+USBSabertoothSimulation* USBSabertoothSimulation::_current = NULL;
+
+USBSabertoothSimulation::USBSabertoothSimulation(uint32_t seed)
+  : _count(0), _now(0), _seed(seed ? seed : 1), _events(0)
+{}
+
+uint32_t USBSabertoothSimulation::clock()
+{
+  return _current->_now;
+}
+
+void USBSabertoothSimulation::begin()
+{
+  _current = this;
+  USBSabertoothTimeout::setClock(clock);
+}
+
+void USBSabertoothSimulation::end()
+{
+  if (_current == this) { USBSabertoothTimeout::setClock(NULL); _current = NULL; }
+}
+
+uint32_t USBSabertoothSimulation::random(uint32_t limit)
+{
+  // xorshift32, the same seed always gives the same numbers
+  _seed ^= _seed << 13; _seed ^= _seed >> 17; _seed ^= _seed << 5;
+  return limit ? _seed % limit : 0;
+}
+
+boolean USBSabertoothSimulation::schedule(USBSabertoothEvent event, void* user, uint32_t delay, uint32_t period, uint32_t jitter)
+{
+  if (_count >= SABERTOOTH_SIMULATION_EVENTS) { return false; }
+  
+  Entry& entry = _entries[_count ++];
+  entry.event = event; entry.user = user;
+  entry.time = _now + delay; entry.period = period; entry.jitter = jitter;
+  return true;
+}
+
+void USBSabertoothSimulation::cancel(USBSabertoothEvent event, void* user)
+{
+  for (byte i = 0; i < _count; )
+  {
+    if (_entries[i].event == event && _entries[i].user == user)
+    {
+      _count --;
+      for (byte j = i; j < _count; j ++) { _entries[j] = _entries[j + 1]; }
+    }
+    else { i ++; }
+  }
+}
+
+void USBSabertoothSimulation::run(uint32_t ticks)
+{
+  uint32_t start = _now;
+  
+  for (;;)
+  {
+    // the earliest event goes first, the one scheduled first among equals;
+    // nothing is due before now, so the times compare as unsigned offsets from it
+    int next = -1;
+    for (byte i = 0; i < _count; i ++)
+    {
+      if (next < 0 || _entries[i].time - _now < _entries[next].time - _now) { next = i; }
+    }
+    if (next < 0 || _entries[next].time - start > ticks) { break; }
+    
+    Entry entry = _entries[next];
+    _now = entry.time;
+    
+    // take it out before calling it, it may schedule or cancel events itself
+    _count --;
+    for (byte j = next; j < _count; j ++) { _entries[j] = _entries[j + 1]; }
+    if (entry.period)
+    {
+      schedule(entry.event, entry.user, entry.period + (entry.jitter ? random(entry.jitter + 1) : 0), entry.period, entry.jitter);
+    }
+    
+    entry.event(entry.user);
+    _events ++;
+  }
+  
+  _now = start + ticks;
+}
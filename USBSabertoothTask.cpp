@@ -0,0 +1,63 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+USBSabertoothTask::USBSabertoothTask()
+  : result(0), _line(0), _wake(0), _state(SABERTOOTH_TASK_READY), _canStart(false)
+{}
+
+USBSabertoothScheduler::USBSabertoothScheduler(USBSabertoothSerial& serial)
+  : _serial(serial), _owner(NULL), _count(0)
+{}
+
+boolean USBSabertoothScheduler::add(USBSabertoothTask& task)
+{
+  if (_count >= SABERTOOTH_MAX_TASKS) { return false; }
+  _tasks[_count ++] = &task;
+  return true;
+}
+
+void USBSabertoothScheduler::resume(USBSabertoothTask* task)
+{
+  // with polling a get is held back until its poll, so a second one would replace it
+  task->_canStart = (_owner == NULL);
+  task->run();
+  if (task->_state == SABERTOOTH_TASK_WAITING) { _owner = task; }
+}
+
+void USBSabertoothScheduler::run()
+{
+  if (_owner)
+  {
+    int result, context;
+    if (!_serial.reply_available(&result, &context)) { return; }
+    
+    USBSabertoothTask* task = _owner; _owner = NULL;
+    task->result = result;
+    task->_state = SABERTOOTH_TASK_COMPLETED;
+    resume(task);
+  }
+  
+  for (byte i = 0; i < _count; i ++)
+  {
+    USBSabertoothTask* task = _tasks[i];
+    if (task->done() || task->_state != SABERTOOTH_TASK_READY) { continue; }
+    resume(task);
+  }
+}
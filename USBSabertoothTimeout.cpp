@@ -18,29 +18,52 @@ USE OR PERFORMANCE OF THIS SOFTWARE.
 
 #include "USBSabertooth_NB.h"
 
+static uint32_t defaultClock()
+{
+#if SABERTOOTH_CLOCK_MICROS
+  return (uint32_t)micros();
+#else
+  return (uint32_t)millis();
+#endif
+}
+
+USBSabertoothClock USBSabertoothTimeout::_clock = defaultClock;
+
+void USBSabertoothTimeout::setClock(USBSabertoothClock clock)
+{
+  _clock = clock ? clock : defaultClock;
+}
+
 USBSabertoothTimeout::USBSabertoothTimeout(int32_t timeoutMS)
-  : _timeoutMS(timeoutMS)
 {
+  setTimeoutMS(timeoutMS);   // clamped, a compact interval would otherwise wrap
   reset();
 }
 
 boolean USBSabertoothTimeout::canExpire() const
 {
-  return _timeoutMS >= 0;
+  return _timeout >= 0;
 }
 
 boolean USBSabertoothTimeout::expired() const
 {
-  return canExpire() && ((uint32_t)millis() - _start >= (uint32_t)_timeoutMS);
+  return canExpire() && ((USBSabertoothTicks)(now() - _start) >= (USBSabertoothTicks)_timeout);
 }
 
 void USBSabertoothTimeout::expire()
 {
   if (!canExpire()) { return; }
-  _start = (uint32_t)millis() - _timeoutMS;
+  _start = (USBSabertoothTicks)(now() - _timeout);
 }
 
 void USBSabertoothTimeout::reset()
 {
-  _start = (uint32_t)millis();
+  _start = (USBSabertoothTicks)now();
+}
+
+int32_t USBSabertoothTimeout::remaining() const
+{
+  if (!canExpire()) { return SABERTOOTH_INFINITE_TIMEOUT; }
+  USBSabertoothTicks elapsed = (USBSabertoothTicks)(now() - _start);
+  return elapsed >= (USBSabertoothTicks)_timeout ? 0 : (int32_t)((USBSabertoothTicks)_timeout - elapsed);
 }
@@ -0,0 +1,108 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+#if SABERTOOTH_TRACE
+#if defined(__AVR__)
+#include <util/atomic.h>   // AVR has no libatomic for 32 bit read-modify-writes
+#endif
+
+USBSabertoothTraceEvent USBSabertoothTrace::_events[SABERTOOTH_TRACE_LENGTH];
+uint32_t                USBSabertoothTrace::_next;
+
+void USBSabertoothTrace::record(USBSabertoothTraceKind kind, const void* object, uint32_t start, int a, int b)
+{
+  uint32_t now = USBSabertoothTimeout::now();
+  uint32_t index;
+#if defined(__AVR__)
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { index = _next ++; }   // interrupts get their own slot
+#else
+  index = __atomic_fetch_add(&_next, 1, __ATOMIC_RELAXED);  // each thread gets its own slot
+#endif
+  
+  USBSabertoothTraceEvent& event = _events[index & (SABERTOOTH_TRACE_LENGTH - 1)];
+  event.time = start;
+  event.duration = (uint16_t)(now - start);
+  event.kind = (byte)kind;
+  event.a = (int16_t)a;
+  event.b = (int16_t)b;
+  event.object = object;
+}
+
+void USBSabertoothTrace::clear()
+{
+#if defined(__AVR__)
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _next = 0; }
+#else
+  __atomic_store_n(&_next, 0, __ATOMIC_RELAXED);
+#endif
+}
+
+static void printMicros(Print& out, uint32_t ticks)
+{
+  // Chrome trace time stamps are in microseconds
+  out.print(ticks * (1000 / SABERTOOTH_TICKS_PER_MS));
+}
+
+void USBSabertoothTrace::writeJSON(Print& out)
+{
+  static const char* const names[] = { "queue", "send", "write", "read", "frame", "reply" };
+  static const char* const argA [] = { "address", "address", "address", "bytes", "address", "result" };
+  static const char* const argB [] = { "getType", "getType", "command", "complete", "command", "context" };
+  
+  uint32_t next;
+#if defined(__AVR__)
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { next = _next; }
+#else
+  next = __atomic_load_n(&_next, __ATOMIC_RELAXED);
+#endif
+  uint32_t first = next > SABERTOOTH_TRACE_LENGTH ? next - SABERTOOTH_TRACE_LENGTH : 0;
+  
+  // time stamps start at 0 from the earliest start: a span is stored when it ends, so it can
+  // follow the marks nested in it and begin before the oldest event stored
+  uint32_t origin = _events[first & (SABERTOOTH_TRACE_LENGTH - 1)].time;
+  for (uint32_t i = first; i < next; i ++)
+  {
+    uint32_t time = _events[i & (SABERTOOTH_TRACE_LENGTH - 1)].time;
+    if ((int32_t)(time - origin) < 0) { origin = time; }
+  }
+  
+  out.print(F("{\"traceEvents\":["));
+  for (uint32_t i = first; i < next; i ++)
+  {
+    const USBSabertoothTraceEvent& event = _events[i & (SABERTOOTH_TRACE_LENGTH - 1)];
+    if (i > first) { out.print(','); }
+    out.print(F("\n{\"name\":\"")); out.print(names[event.kind]);
+    out.print(F("\",\"pid\":1,\"tid\":")); out.print((unsigned long)(uintptr_t)event.object);
+    out.print(F(",\"ts\":")); printMicros(out, event.time - origin);
+    if (event.kind == SABERTOOTH_TRACE_WRITE || event.kind == SABERTOOTH_TRACE_READ)
+    {
+      out.print(F(",\"ph\":\"X\",\"dur\":")); printMicros(out, event.duration);
+    }
+    else
+    {
+      out.print(F(",\"ph\":\"i\",\"s\":\"t\""));
+    }
+    out.print(F(",\"args\":{\"")); out.print(argA[event.kind]); out.print(F("\":")); out.print(event.a);
+    out.print(F(",\""));            out.print(argB[event.kind]); out.print(F("\":")); out.print(event.b);
+    out.print(F("}}"));
+  }
+  out.println(F("\n]}"));
+}
+#endif
@@ -0,0 +1,69 @@
+/*
+Arduino Library for USB Sabertooth Packet Serial
+Copyright (c) 2013 Dimension Engineering LLC
+http://www.dimensionengineering.com/arduino
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE
+USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "USBSabertooth_NB.h"
+
+int32_t USBSabertoothLinear::convert(int raw) const
+{
+  // |raw| * |scale| is split into whole and fractional parts so nothing overflows 32 bits
+  boolean  negative = (raw < 0) != (scale < 0);
+  uint32_t x = raw   < 0 ? -(int32_t)raw : raw;
+  uint32_t s = scale < 0 ? -scale        : scale;
+  uint32_t product = x * (s >> 16) + ((x * (s & 0xffff) + 0x8000) >> 16);
+  return (negative ? -(int32_t)product : (int32_t)product) + bias;
+}
+
+USBSabertoothLinear USBSabertoothLinear::fromPoints(int rawA, int32_t unitA, int rawB, int32_t unitB)
+{
+  USBSabertoothLinear linear;
+  linear.scale = (int32_t)(((int64_t)(unitB - unitA) << 16) / (rawB - rawA));
+  linear.bias  = 0;
+  linear.bias  = unitA - linear.convert(rawA);
+  return linear;
+}
+
+USBSabertoothUnits::USBSabertoothUnits()
+  : _table(NULL)
+{
+  USBSabertoothLinear identity = { 0x10000, 0 };
+  _battery = _current = _temperature = identity;
+}
+
+void USBSabertoothUnits::setTemperatureTable(const int16_t* table, byte points, int first, byte stepShift)
+{
+  _table = points >= 2 ? table : NULL;
+  _tablePoints = points; _tableFirst = first; _tableShift = stepShift;
+}
+
+int32_t USBSabertoothUnits::decidegrees(int raw) const
+{
+  if (!_table) { return _temperature.convert(raw); }
+  
+  // clamp to the table, then interpolate between the two surrounding values
+  int32_t offset = (int32_t)raw - _tableFirst;
+  int32_t last   = (int32_t)(_tablePoints - 1) << _tableShift;
+  if (offset < 0   ) { offset = 0;    }
+  if (offset > last) { offset = last; }
+  
+  byte    i    = (byte)(offset >> _tableShift);
+  int32_t step = offset - ((int32_t)i << _tableShift);
+  int32_t a    = (int16_t)pgm_read_word(&_table[i]);
+  if (step == 0) { return a; }
+  int32_t b    = (int16_t)pgm_read_word(&_table[i + 1]);
+  return a + (((b - a) * step + ((int32_t)1 << _tableShift >> 1)) >> _tableShift);
+}
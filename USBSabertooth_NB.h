@@ -48,6 +48,100 @@ Include this file to use the USB Sabertooth Arduino library.
 #define SABERTOOTH_INFINITE_TIMEOUT            -1
 #define SABERTOOTH_MAX_VALUE                    16383
 
+#ifndef SABERTOOTH_CLOCK_MICROS
+#define SABERTOOTH_CLOCK_MICROS                 0     /* 1 counts timeouts in microseconds instead of milliseconds */
+#endif
+
+#if SABERTOOTH_CLOCK_MICROS
+#define SABERTOOTH_TICKS_PER_MS                 1000
+#else
+#define SABERTOOTH_TICKS_PER_MS                 1
+#endif
+
+#ifndef SABERTOOTH_COMPACT
+#define SABERTOOTH_COMPACT                      0     /* 1 packs flags and uses 16 bit timestamps to save RAM */
+#endif
+
+#ifndef SABERTOOTH_NO_SYNC_GET
+#define SABERTOOTH_NO_SYNC_GET                  0     /* 1 leaves out the blocking get functions */
+#endif
+
+#ifndef SABERTOOTH_CRC_ONLY
+#define SABERTOOTH_CRC_ONLY                     0     /* 1 leaves out the checksum path */
+#endif
+
+#ifndef SABERTOOTH_CHECKSUM_ONLY
+#define SABERTOOTH_CHECKSUM_ONLY                0     /* 1 leaves out the CRC path */
+#endif
+
+#if SABERTOOTH_CRC_ONLY && SABERTOOTH_CHECKSUM_ONLY
+#error "SABERTOOTH_CRC_ONLY and SABERTOOTH_CHECKSUM_ONLY can not be both set."
+#endif
+
+#if SABERTOOTH_COMPACT
+#define SABERTOOTH_BIT                          : 1
+typedef uint16_t USBSabertoothTicks;
+typedef int16_t  USBSabertoothInterval;
+#define SABERTOOTH_MAX_INTERVAL                 INT16_MAX
+#else
+#define SABERTOOTH_BIT
+typedef uint32_t USBSabertoothTicks;
+typedef int32_t  USBSabertoothInterval;
+#define SABERTOOTH_MAX_INTERVAL                 INT32_MAX
+#endif
+
+#if SABERTOOTH_CRC_ONLY
+#define SABERTOOTH_USE_CRC(useCRC)              ((void)(useCRC), true)
+#elif SABERTOOTH_CHECKSUM_ONLY
+#define SABERTOOTH_USE_CRC(useCRC)              ((void)(useCRC), false)
+#else
+#define SABERTOOTH_USE_CRC(useCRC)              (useCRC)
+#endif
+
+#ifndef SABERTOOTH_EMULATOR_QUEUE_LENGTH
+#define SABERTOOTH_EMULATOR_QUEUE_LENGTH        40    /* reply bytes an emulated line can hold */
+#endif
+
+#ifndef SABERTOOTH_ARBITER_SLOTS
+#define SABERTOOTH_ARBITER_SLOTS                4     /* gets a USBSabertoothArbiter can hold */
+#endif
+
+#ifndef SABERTOOTH_SAMPLER_CHANNELS
+#define SABERTOOTH_SAMPLER_CHANNELS             8     /* readings a USBSabertoothSampler can follow */
+#endif
+
+#ifndef SABERTOOTH_PROBE_RATES
+#define SABERTOOTH_PROBE_RATES                  8     /* baud rates a USBSabertoothBaudProbe can try */
+#endif
+
+#ifndef SABERTOOTH_SIMULATION_EVENTS
+#define SABERTOOTH_SIMULATION_EVENTS            8     /* events a USBSabertoothSimulation can hold */
+#endif
+
+#ifndef SABERTOOTH_MAX_TASKS
+#define SABERTOOTH_MAX_TASKS                    4     /* tasks a USBSabertoothScheduler can run */
+#endif
+
+#ifndef SABERTOOTH_CRC_TABLES
+#if defined(__AVR__)
+#define SABERTOOTH_CRC_TABLES                   0     /* bitwise CRCs, saves 768 bytes of flash */
+#else
+#define SABERTOOTH_CRC_TABLES                   1     /* table driven CRCs */
+#endif
+#endif
+
+#ifndef SABERTOOTH_TRACE
+#define SABERTOOTH_TRACE                        0     /* 1 records trace points, see USBSabertoothTrace */
+#endif
+
+#ifndef SABERTOOTH_TRACE_LENGTH
+#define SABERTOOTH_TRACE_LENGTH                 256   /* trace events kept, must be a power of two */
+#endif
+
+#ifndef SABERTOOTH_QUEUE_LENGTH
+#define SABERTOOTH_QUEUE_LENGTH                 8     /* must be a power of two, 128 at most */
+#endif
+
 enum USBSabertoothCommand
 {
   SABERTOOTH_CMD_SET = 40,
@@ -67,6 +161,37 @@ enum USBSabertoothGetType
   SABERTOOTH_GET_TEMPERATURE = 0x40
 };
 
+enum USBSabertoothCaptureDirection
+{
+  SABERTOOTH_CAPTURE_TX = 0x00,
+  SABERTOOTH_CAPTURE_RX = 0x80
+};
+
+enum USBSabertoothTelemetryField
+{
+  SABERTOOTH_TELEMETRY_BATTERY      = 0,
+  SABERTOOTH_TELEMETRY_VALUE1       = 1,
+  SABERTOOTH_TELEMETRY_VALUE2       = 2,
+  SABERTOOTH_TELEMETRY_CURRENT1     = 3,
+  SABERTOOTH_TELEMETRY_CURRENT2     = 4,
+  SABERTOOTH_TELEMETRY_TEMPERATURE1 = 5,
+  SABERTOOTH_TELEMETRY_TEMPERATURE2 = 6,
+  SABERTOOTH_TELEMETRY_FIELDS       = 7,
+  SABERTOOTH_TELEMETRY_ALL          = 0x7f   /* mask of all fields */
+};
+
+enum USBSabertoothShadowChannel
+{
+  SABERTOOTH_SHADOW_M1 = 0, SABERTOOTH_SHADOW_M2,
+  SABERTOOTH_SHADOW_MD,     SABERTOOTH_SHADOW_MT,
+  SABERTOOTH_SHADOW_P1,     SABERTOOTH_SHADOW_P2,
+  SABERTOOTH_SHADOW_Q1,     SABERTOOTH_SHADOW_Q2,
+  SABERTOOTH_SHADOW_R1,     SABERTOOTH_SHADOW_R2,
+  SABERTOOTH_SHADOW_SHUTDOWN_M1, SABERTOOTH_SHADOW_SHUTDOWN_M2,
+  SABERTOOTH_SHADOW_SHUTDOWN_P1, SABERTOOTH_SHADOW_SHUTDOWN_P2,
+  SABERTOOTH_SHADOW_CHANNELS
+};
+
 enum USBSabertoothSetType
 {
   SABERTOOTH_SET_VALUE     = 0x00,
@@ -123,6 +248,16 @@ private:
   uint16_t _crc;
 };
 
+typedef uint32_t (*USBSabertoothClock)();
+
+/*!
+\class USBSabertoothTimeout
+\brief Timeouts count clock ticks: milliseconds, or microseconds when the library is
+       built with SABERTOOTH_CLOCK_MICROS set to 1. The clock itself can be replaced,
+       for example by a host monotonic clock or a virtual clock for simulations.
+       With SABERTOOTH_COMPACT only the low 16 bits are kept, so intervals are limited
+       to SABERTOOTH_MAX_INTERVAL ticks.
+*/
 class USBSabertoothTimeout
 {
 public:
@@ -133,14 +268,46 @@ public:
   boolean expired() const;
   void expire();
   void reset();
+  int32_t remaining() const;
 
 public:
-  inline void setTimeoutMS( int32_t interval ) { _timeoutMS = interval; }
-  inline int32_t timeoutMS() const { return _timeoutMS; }  
+  inline void setTimeoutMS( int32_t interval ) { setTimeoutTicks( ticksFromMS( interval ) ); }
+  inline int32_t timeoutMS() const { return _timeout / SABERTOOTH_TICKS_PER_MS; }  
+  inline void setTimeoutTicks( int32_t interval ) { _timeout = (USBSabertoothInterval)(interval > SABERTOOTH_MAX_INTERVAL ? SABERTOOTH_MAX_INTERVAL : interval < 0 ? -1 : interval); }
+  inline int32_t timeoutTicks() const { return _timeout; }
+  
+public:
+  /*!
+  Replaces the clock used by all timeouts.
+  \param clock A function returning the current time in ticks, or NULL for the default
+               millis() or micros().
+  */
+  static void setClock(USBSabertoothClock clock);
+  
+  /*!
+  Gets the current time.
+  \return The current time, in ticks.
+  */
+  static inline uint32_t now() { return _clock(); }
+  
+  /*!
+  Converts milliseconds to clock ticks, saturating instead of overflowing.
+  */
+  static inline int32_t ticksFromMS( int32_t ms ) { return ms > INT32_MAX / SABERTOOTH_TICKS_PER_MS ? INT32_MAX : ms * SABERTOOTH_TICKS_PER_MS; }
+  
+  /*!
+  Compares two times across wrap around, full clock times or USBSabertoothTicks.
+  \return true if time a is later than time b.
+  */
+  static inline boolean later(uint32_t a, uint32_t b) { return (int32_t)(a - b) > 0; }
+#if SABERTOOTH_COMPACT
+  static inline boolean later(USBSabertoothTicks a, USBSabertoothTicks b) { return (USBSabertoothInterval)(a - b) > 0; }
+#endif
   
 private:
-  uint32_t _start;
-  int32_t  _timeoutMS;
+  static USBSabertoothClock _clock;
+  USBSabertoothTicks    _start;
+  USBSabertoothInterval _timeout;
 };
 
 class USBSabertoothReplyReceiver
@@ -152,7 +319,7 @@ public:
   inline       byte                   address () const { return _data[0];                         }
   inline       USBSabertoothReplyCode command () const { return (USBSabertoothReplyCode)_data[1]; }
   inline const byte*                  data    () const { return _data;                            }
-  inline       boolean                usingCRC() const { return _usingCRC;                        }
+  inline       boolean                usingCRC() const { return SABERTOOTH_USE_CRC(_usingCRC);    }
   
 public:
   inline boolean ready() const { return _ready; }
@@ -161,8 +328,8 @@ public:
   
 private:
   byte    _data[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
-  size_t  _length;
-  boolean _ready, _usingCRC;
+  byte    _length;
+  boolean _ready SABERTOOTH_BIT, _usingCRC SABERTOOTH_BIT;
 };
 
 struct USBSabertoothRequest
@@ -170,227 +337,1004 @@ struct USBSabertoothRequest
   byte           commandData[SABERTOOTH_GETCOMMAND_DATA_LENGTH];
   int            context;
   byte           address;
-  boolean        crc;
+  boolean        crc SABERTOOTH_BIT;
   
-  USBSabertoothRequest() : _pending(false), _timeout(SABERTOOTH_DEFAULT_GET_TIMEOUT) {  _timeout.expire(); }
+  USBSabertoothRequest() : _pending(false), _cancelled(false), _timeout(SABERTOOTH_DEFAULT_GET_TIMEOUT), 
+                           _deadline(SABERTOOTH_INFINITE_TIMEOUT) {  _timeout.expire(); }
 
   inline uint32_t  timeoutMS() const { return _timeout.timeoutMS(); }
   inline void      setTimeoutMS( uint32_t interval ) { _timeout.setTimeoutMS( interval );  }
-  inline boolean   expired() const { return _timeout.expired(); }
-  inline void      expire() { _timeout.expire(); _pending = false; }
+  inline int32_t   timeoutTicks() const { return _timeout.timeoutTicks(); }
+  inline void      setTimeoutTicks( int32_t interval ) { _timeout.setTimeoutTicks( interval );  }
+  inline boolean   expired() const { return _timeout.expired() || _deadline.expired(); }
+  inline void      expire() { _timeout.expire(); _pending = _cancelled = false; }
   inline void      reset() { _timeout.reset(); _pending = true; }
   inline boolean   pending() const { return _pending; }
+  inline int32_t   remaining() const { int32_t a = _timeout.remaining(), b = _deadline.remaining(); return a < 0 || (b >= 0 && b < a) ? b : a; }
+  
+  inline void      setDeadlineTicks( int32_t interval ) { _deadline.setTimeoutTicks( interval ); _deadline.reset(); }
+  inline void      clearDeadline() { _deadline.setTimeoutTicks( SABERTOOTH_INFINITE_TIMEOUT ); }
+  inline boolean   missedDeadline() const { return _deadline.expired(); }
+  inline int32_t   deadlineRemaining() const { return _deadline.remaining(); }
+  inline void      cancel() { _cancelled = true; }
+  inline boolean   cancelled() const { return _cancelled; }
 
 private:
-  USBSabertoothTimeout  _timeout; 
-  boolean               _pending; 
+  boolean               _pending SABERTOOTH_BIT, _cancelled SABERTOOTH_BIT; 
+  USBSabertoothTimeout  _timeout, _deadline; 
 };
 
 /*!
-\class USBSabertoothSerial
-\brief Create a USBSabertoothSerial for the serial port you are using, and then
-       attach a USBSabertooth for each motor driver you want to communicate with.
+\struct USBSabertoothTelemetry
+\brief Snapshot filled by a telemetry sweep, see USBSabertooth::async_getTelemetry.
 */
-class USBSabertoothSerial
+struct USBSabertoothTelemetry
 {
-  friend class USBSabertooth;
+  int16_t  values[SABERTOOTH_TELEMETRY_FIELDS];   // indexed by USBSabertoothTelemetryField
+  byte     valid;                                 // bit (1 << field) is set for every field received
+  uint32_t time;                                  // USBSabertoothTimeout::now() when the sweep completed
   
-public:
-  /*!
-  Constructs a USBSabertoothSerial object.
-  \param port The serial port the motor driver is on.
-              By default, this is the Arduino TX pin.
-  */
-  USBSabertoothSerial(Stream& port = SabertoothTXPinSerial);
+  inline boolean isValid    (USBSabertoothTelemetryField field) const { return (valid >> field) & 1; }
+  inline int     battery    ()                const { return values[SABERTOOTH_TELEMETRY_BATTERY]; }
+  inline int     value      (byte motorOutput) const { return values[SABERTOOTH_TELEMETRY_VALUE1       + (motorOutput == 2)]; }
+  inline int     current    (byte motorOutput) const { return values[SABERTOOTH_TELEMETRY_CURRENT1     + (motorOutput == 2)]; }
+  inline int     temperature(byte motorOutput) const { return values[SABERTOOTH_TELEMETRY_TEMPERATURE1 + (motorOutput == 2)]; }
   
-public:
-  /*!
-  Gets the serial port being used.
-  \return The serial port.
-  */
-  inline Stream& port() const { return _port; }
+  // sweep state, owned by USBSabertoothSerial
+  byte    _fields, _field, _address;
+  boolean _crc SABERTOOTH_BIT, _unscaled SABERTOOTH_BIT;
+  int     _context;
+};
 
+/*!
+\struct USBSabertoothLinear
+\brief Linear conversion of an unscaled reading: raw * scale / 65536 + bias, rounded half away from zero.
+       Only 32 bit integer arithmetic is used, so results are the same on every target.
+*/
+struct USBSabertoothLinear
+{
+  int32_t scale;      // units per count, 16.16 fixed point
+  int32_t bias;       // units
+  
+  int32_t convert(int raw) const;
+  
   /*!
-  Checks whether a reply from any of the USBSabertooth async_get function calls is available. 
-  Always returns immediatelly, must be called repeadly until it returns true either with a response or an error. 
-  \param type (returned by reference) The type of channel to get from. See get function. Always updated
-  \param number (returned by reference) The number of the channel, 1 or 2. Always updated
-  \param getType (returned by reference) The Get command type. Always updated
-  \param result (returned by reference) The resulting value, SABERTOOTH_GET_ERROR, or SABERTOOTH_GET_TIMED_OUT. 
-        Only updated in case of success, i.e the funcion returning true, undefined otherwise
-  \return true if new data is available or the get command timed out, false otherwhise 
+  Makes the conversion going through two calibration points.
+  \param rawA  The unscaled reading at the first point.
+  \param unitA The value in units at the first point.
+  \param rawB  The unscaled reading at the second point, different from rawA.
+  \param unitB The value in units at the second point.
   */
-  boolean reply_available( byte *type, byte *number, USBSabertoothGetType *getType, int *result, int *context );
-  boolean reply_available( byte *type, byte *number, int *result, int *context );
-  boolean reply_available( byte *number, int *result, int *context );
-  boolean reply_available( int *result, int *context );
+  static USBSabertoothLinear fromPoints(int rawA, int32_t unitA, int rawB, int32_t unitB);
+};
+
+/*!
+\class USBSabertoothUnits
+\brief Converts unscaled readings of one motor driver to engineering units without floating point.
+       Battery and current use a linear conversion, temperature either a linear conversion or a
+       table of values at evenly spaced readings, interpolated linearly. Attach one to each
+       driver with USBSabertooth::setUnits.
+*/
+class USBSabertoothUnits
+{
+public:
+  USBSabertoothUnits();
+  
+public:
+  inline void setBattery    (const USBSabertoothLinear& linear) { _battery     = linear; }
+  inline void setCurrent    (const USBSabertoothLinear& linear) { _current     = linear; }
+  inline void setTemperature(const USBSabertoothLinear& linear) { _temperature = linear; _table = NULL; }
   
   /*!
-  Gets the poll interval.
-  \return The poll interval, in milliseconds.
+  Uses a table for the temperature.
+  \param table     Values in tenths of a degree, for raw readings first, first + (1 << stepShift), ...
+                   The table must be in PROGMEM.
+  \param points    The number of values in the table, at least 2.
+  \param first     The raw reading of the first value.
+  \param stepShift The log2 of the raw reading step between values.
   */
-  inline int32_t getPollInterval() const { return _poll.timeoutMS(); }
+  void setTemperatureTable(const int16_t* table, byte points, int first, byte stepShift);
   
+public:
   /*!
-  Sets the poll interval.
-  \param timeoutMS The poll interval, in milliseconds.
+  Converts an unscaled battery reading.
+  \return The battery voltage, in millivolts.
   */
-  inline void setPollInterval(int32_t timeoutMS) { _poll.setTimeoutMS(timeoutMS); }
-
+  inline int32_t millivolts(int raw) const { return _battery.convert(raw); }
+  
   /*!
-  Gets the get timeout.
-  \return The get timeout, in milliseconds.
+  Converts an unscaled current reading.
+  \return The motor current, in milliamps.
   */
-  inline int32_t getGetTimeout() const { return _request.timeoutMS(); }
+  inline int32_t milliamps(int raw) const { return _current.convert(raw); }
   
   /*!
-  Sets the get timeout.
-  \param timeoutMS The get timeout, in milliseconds.
+  Converts an unscaled temperature reading.
+  \return The temperature, in tenths of a degree Celsius.
   */
-  inline void setGetTimeout(int32_t timeoutMS) { _request.setTimeoutMS(timeoutMS); }
-
+  int32_t decidegrees(int raw) const;
+  
 private:
-  void    write    (byte address, USBSabertoothCommand command, boolean useCRC, const byte* data, size_t lengthOfData);
-  void    set      (byte address, boolean useCrc, byte type, byte number, int value, USBSabertoothSetType setType);
-  int     get      (byte address, boolean useCrc, byte type, byte number, USBSabertoothGetType getType, boolean unescaled);
-  boolean async_get(byte address, boolean useCrc, byte type, byte number, USBSabertoothGetType getType, int context, boolean unescaled);
-  boolean tryReceivePacket();
-  void    clearSerial();
+  USBSabertoothLinear _battery, _current, _temperature;
+  const int16_t*      _table;
+  int                 _tableFirst;
+  byte                _tablePoints, _tableShift;
+};
 
-private:
-  USBSabertoothSerial(USBSabertoothSerial& serial); // no copy
-  void operator =    (USBSabertoothSerial& serial);
+/*!
+\struct USBSabertoothSample
+\brief One value kept by a USBSabertoothHistory.
+*/
+struct USBSabertoothSample
+{
+  uint32_t time;      // USBSabertoothTimeout::now() when the value was added
+  int      value;
+};
 
-private:
-  USBSabertoothReplyReceiver _receiver;
-  USBSabertoothRequest       _request;
-  USBSabertoothTimeout       _poll;
-  Stream&                    _port;
+/*!
+\struct USBSabertoothBucket
+\brief Summary of a run of older values kept by a USBSabertoothHistory.
+*/
+struct USBSabertoothBucket
+{
+  uint32_t time;      // time of the first value in the bucket
+  int16_t  min, max, avg;
 };
 
 /*!
-\class USBSabertooth
-\brief Controls a USB Sabertooth motor driver running in Packet Serial mode.
+\struct USBSabertoothHistoryIterator
+\brief Position of a USBSabertoothHistory::next walk. Start it with USBSabertoothHistory::begin.
 */
-class USBSabertooth
+struct USBSabertoothHistoryIterator
+{
+  size_t   position;
+  size_t   index;
+  uint32_t time;
+  int      value;
+};
+
+/*!
+\class USBSabertoothHistory
+\brief Compressed history of one telemetry value, such as the battery voltage or a motor current.
+       Recent values are kept at full rate as variable length time and value deltas, usually
+       two bytes per value, in a ring that forgets the oldest first. Every samplesPerBucket values
+       are also summarized as min, max and average into a ring of buckets, which covers a much
+       longer span at lower resolution.
+*/
+class USBSabertoothHistory
 {
 public:
   /*!
-  Initializes a new instance of the USBSabertooth class.
-  The driver address is set to the value given, and the specified serial port is used.
-  \param serial The USBSabertoothSerial whose serial port the motor driver is on.
-  \param address The driver address.
+  Constructs a USBSabertoothHistory.
+  \param recent           Storage for the full rate values.
+  \param recentSize       The size of that storage, in bytes, at least 16.
+  \param buckets          Storage for the summaries, may be NULL.
+  \param bucketCount      The number of summaries.
+  \param samplesPerBucket The number of values summarized by each bucket.
   */
-  USBSabertooth(USBSabertoothSerial& serial, byte address);
+  USBSabertoothHistory(byte* recent, size_t recentSize,
+                       USBSabertoothBucket* buckets = NULL, byte bucketCount = 0, uint16_t samplesPerBucket = 60);
   
 public:
   /*!
-  Gets the driver address.
-  \return The driver address.
+  Adds a value, for example a reply or a telemetry snapshot field.
+  \param value The value.
   */
-  inline byte address() const { return _address; }
-
+  inline void add(int value) { add(value, USBSabertoothTimeout::now()); }
+  
   /*!
-  Sends a packet serial command to the motor driver.
-  \param command The number of the command.
-  \param value   The command's value.
+  Adds a value taken at a given time.
+  \param value The value.
+  \param time  The time, in clock ticks.
   */
-  void command(USBSabertoothCommand cmd, byte value);
+  void add(int value, uint32_t time);
   
   /*!
-  Sends a multibyte packet serial command to the motor driver.
-  \param command The number of the command.
-  \param value   The command's value.
-  \param bytes   The number of bytes in the value.
+  Forgets all values.
   */
-  void command(USBSabertoothCommand cmd, const byte* value, size_t bytes);
+  void clear();
   
-public:
   /*!
-  Controls motor output 1.
-  In User Mode, this sets M1.
-  \param value The value, between -2047 and 2047.
+  Starts a walk through the full rate values, oldest first.
   */
-  void motor(int value);
+  void begin(USBSabertoothHistoryIterator* iterator) const;
   
   /*!
-  Controls the specified motor output.
-  In User Mode, this sets M1 or M2.
-  \param motorOutputNumber The motor output number, 1 or 2.
-                           You can also use a character, such as '3', to select the
-                           motor output by its Plain Text Serial address.
-  \param value             The value, between -2047 and 2047.
+  Reads the next full rate value.
+  \return true if a value was read, false at the end.
   */
-  void motor(byte motorOutputNumber, int value);
+  boolean next(USBSabertoothHistoryIterator* iterator, USBSabertoothSample* sample) const;
   
   /*!
-  Controls power output 1, if power output 1 is configured as a controllable output.
-  In User Mode, this sets P1.
-  \param value The value, between -2047 and 2047.
+  Reads a summary, oldest first.
+  \param index  The summary number, below bucketsUsed().
+  \param bucket (returned by reference) The summary.
+  \return true if the summary exists.
   */
-  void power(int value);
+  boolean bucket(byte index, USBSabertoothBucket* bucket) const;
+  
+public:
+  inline size_t   samples    () const { return _samples;     }   // at most one per two bytes of storage, never wraps
+  inline byte     bucketsUsed() const { return _bucketsUsed; }
+  
+private:
+  inline byte     at   (size_t position) const { return _recent[(_start + position) % _recentSize]; }
+  uint32_t        varint(size_t* position) const;
+  void            put   (uint32_t value);
+  void            dropOldest();
+  
+private:
+  byte*                _recent;
+  size_t               _recentSize, _start, _used, _samples;
+  USBSabertoothSample  _first, _last;
   
+  USBSabertoothBucket* _buckets;
+  byte                 _bucketCount, _bucketStart, _bucketsUsed;
+  uint16_t             _samplesPerBucket, _pending;
+  int32_t              _sum;
+  USBSabertoothBucket  _current;
+};
+
+/*!
+\struct USBSabertoothCaptureRecord
+\brief One captured packet.
+*/
+struct USBSabertoothCaptureRecord
+{
+  uint32_t time;        // USBSabertoothTimeout::now() when the packet was written or framed
+  byte     direction;   // SABERTOOTH_CAPTURE_TX or SABERTOOTH_CAPTURE_RX
+  byte     length;
+  byte     data[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+};
+
+/*!
+\class USBSabertoothCapture
+\brief Keeps a log of the packets sent and received by a USBSabertoothSerial.
+       Records are stored back to back in a caller supplied buffer as a header byte
+       (direction | length), a 32 bit little endian timestamp and the packet bytes.
+       When the buffer is full the oldest records are dropped. The buffer can be a
+       plain array on MCUs or a memory mapped file on hosts.
+*/
+class USBSabertoothCapture
+{
+public:
   /*!
-  Controls the specified power output, if the power output is configured as a controllable output.
-  In User Mode, this sets P1 or P2.
-  \param powerOutputNumber The power output number, 1 or 2.
-                           You can also use a character, such as '3', to select the
-                           power output by its Plain Text Serial address.
-  \param value             The value, between -2047 and 2047.
+  Constructs a USBSabertoothCapture.
+  \param buffer The storage for the records.
+  \param size   The size of the storage, in bytes.
   */
-  void power(byte powerOutputNumber, int value);
+  USBSabertoothCapture(byte* buffer, size_t size);
   
+public:
   /*!
-  Controls the mixed-mode drive channel.
-  In User Mode, this sets MD.
-  \param value The value, between -2047 and 2047.
+  Appends a packet to the log.
+  \param direction SABERTOOTH_CAPTURE_TX or SABERTOOTH_CAPTURE_RX.
+  \param data      The packet bytes.
+  \param length    The number of packet bytes.
   */
-  void drive(int value);
+  void record(USBSabertoothCaptureDirection direction, const byte* data, size_t length);
   
   /*!
-  Controls the mixed-mode turn channel.
-  In User Mode, this sets MT.
-  \param value The value, between -2047 and 2047.
+  Reads a record, oldest first.
+  \param position (updated by reference) The read position, start at 0.
+  \param record   (returned by reference) The record.
+  \return true if a record was read, false at the end of the log.
   */
-  void turn(int value);
+  boolean read(size_t* position, USBSabertoothCaptureRecord* record) const;
   
   /*!
-  Causes motor output 1 to freewheel.
-  In User Mode, this sets Q1.
-  \param value  true or a positive value lets the motor outputs freewheel.
-                false or a negative or zero value stops the freewheeling.
+  Writes the whole log, oldest record first, in the storage format.
+  \param out Where to write it, for example a serial port or a file.
   */
-  void freewheel(int value = 2048);
+  void writeTo(Print& out) const;
   
   /*!
-  Causes the specified motor output to freewheel.
-  In User Mode, this sets Q1 or Q2.
-  \param motorOutputNumber The motor output number, 1 or 2.
-                           You can also use a character, such as '3', to select the
-                           motor output by its Plain Text Serial address.
-  \param value             true or a positive value lets the motor output freewheel.
-                           false or a negative or zero value stops the freewheeling.
+  Drops all records.
   */
-  void freewheel(byte motorOutputNumber, int value = 2048);
+  inline void clear() { _start = _used = 0; }
   
   /*!
-  Shuts down an output.
-  \param type   The type of output to shut down. This can be
-                'M' (motor output) or
-                'P' (power output).
-  \param number The number of the output, 1 or 2.
-                You can also use a character, such as '3', to select by
-                Plain Text Serial address.
-  \param value  true sets the shutdown.
-                false clears the shutdown.
+  Gets the number of bytes in use.
   */
-  void shutDown(byte type, byte number, boolean value = true);
+  inline size_t size() const { return _used; }
   
-public:
-  /*!
-  Sets a value on the motor driver.
-  \param type   The type of channel to set. This can be
-                'M' (motor output),
+private:
+  inline byte at(size_t position) const { return _buffer[(_start + position) % _size]; }
+  
+private:
+  byte*  _buffer;
+  size_t _size, _start, _used;
+};
+
+/*!
+\class USBSabertoothReplay
+\brief A Stream that plays back the replies of a USBSabertoothCapture.
+       Construct a USBSabertoothSerial on it and run the same application code to
+       reproduce a field session. Written bytes are compared with the captured
+       ones and differences are counted.
+*/
+class USBSabertoothReplay : public Stream
+{
+public:
+  /*!
+  Constructs a USBSabertoothReplay.
+  \param capture  The capture to play back.
+  \param realTime If true, replies become available with their captured timing.
+                  If false, they are available as fast as they are read.
+  */
+  USBSabertoothReplay(const USBSabertoothCapture& capture, boolean realTime = false);
+  
+public:
+  /*!
+  Restarts the playback from the first record.
+  */
+  void rewind();
+  
+  /*!
+  Gets whether all captured replies were read.
+  */
+  boolean finished();
+  
+  /*!
+  Gets the number of written bytes that differ from the captured ones.
+  */
+  inline uint32_t mismatches() const { return _mismatches; }
+  
+public:
+  virtual int    available();
+  virtual int    read();
+  virtual int    peek();
+  virtual size_t write(uint8_t data);
+  using Print::write;
+  
+private:
+  boolean next(size_t* position, byte direction, USBSabertoothCaptureRecord* record);
+  boolean due();
+  
+private:
+  const USBSabertoothCapture& _capture;
+  USBSabertoothCaptureRecord  _rx, _tx;
+  size_t                      _rxPosition, _txPosition;
+  byte                        _rxIndex, _txIndex;
+  boolean                     _realTime;
+  uint32_t                    _start, _first, _mismatches;
+};
+
+/*!
+\struct USBSabertoothPacket
+\brief A packet found by USBSabertoothPacketDecoder, in either direction.
+*/
+struct USBSabertoothPacket
+{
+  const byte* bytes;      // the raw packet, valid only during the handler call
+  byte        length;
+  byte        address;
+  byte        command;    // SABERTOOTH_CMD_SET, SABERTOOTH_CMD_GET, SABERTOOTH_RC_GET or other
+  boolean     crc;
+  boolean     valid;      // length and checksum or CRC are correct
+  byte        flags;      // set type, get type, 2 for unscaled, 1 for negative values
+  byte        type;
+  byte        number;
+  int         value;      // set value or get reply, 0 for gets
+};
+
+typedef void (*USBSabertoothPacketHandler)(const USBSabertoothPacket& packet, void* user);
+
+/*!
+\struct USBSabertoothAddressStats
+\brief Packet counts for one driver address.
+*/
+struct USBSabertoothAddressStats
+{
+  uint32_t sets, gets, replies, other, invalid;
+};
+
+/*!
+\class USBSabertoothPacketDecoder
+\brief Decodes raw captured line traffic, in both directions.
+       Every header byte has its high bit set and every other byte has it clear,
+       so packets are cut at header bytes and then validated. Feed it buffers of any
+       size, for example a memory mapped sniffer dump; packets spanning two buffers
+       are carried over. Statistics are kept for each of the 8 addresses of a line.
+*/
+class USBSabertoothPacketDecoder
+{
+public:
+  /*!
+  Constructs a USBSabertoothPacketDecoder.
+  \param handler Called for every packet, valid or not. May be NULL.
+  \param user    Passed to the handler.
+  */
+  USBSabertoothPacketDecoder(USBSabertoothPacketHandler handler = NULL, void* user = NULL);
+  
+public:
+  /*!
+  Decodes the next part of the byte stream.
+  \param data   The bytes.
+  \param length The number of bytes.
+  */
+  void decode(const byte* data, size_t length);
+  
+  /*!
+  Decodes the packet still being carried over at the end of the stream.
+  */
+  void finish();
+  
+  /*!
+  Clears the statistics and any carried over bytes.
+  */
+  void reset();
+  
+  /*!
+  Decodes and validates a single packet.
+  \param bytes  The packet, starting with its header byte.
+  \param length The packet length.
+  \param packet (returned by reference) The decoded packet.
+  */
+  static void parse(const byte* bytes, size_t length, USBSabertoothPacket* packet);
+  
+  /*!
+  Writes a packet as a CSV line: address,command,crc,valid,flags,type,number,value.
+  */
+  static void printCSV(Print& out, const USBSabertoothPacket& packet);
+  
+  /*!
+  Writes the statistics as CSV lines: address,sets,gets,replies,other,invalid.
+  */
+  void printStats(Print& out) const;
+  
+public:
+  inline const USBSabertoothAddressStats& stats(byte address) const { return _stats[address & 7]; }
+  inline uint32_t skipped() const { return _skipped; }
+  
+private:
+  void emit(const byte* bytes, size_t length);
+  
+private:
+  USBSabertoothPacketHandler _handler;
+  void*                      _user;
+  USBSabertoothAddressStats  _stats[8];
+  uint32_t                   _skipped;
+  byte                       _partial[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+  byte                       _partialLength;
+};
+
+/*!
+\class USBSabertoothEmulator
+\brief A Stream emulating a line with up to 8 motor drivers, addresses 128 to 135.
+       Bytes take the time of the baud rate to travel in each direction, sets update the
+       emulated drivers and gets are answered with their state. Current follows the motor
+       output value. Use it to try out or benchmark code without hardware; together with
+       USBSabertoothTimeout::setClock it runs on virtual time.
+*/
+class USBSabertoothEmulator : public Stream
+{
+public:
+  /*!
+  Constructs a USBSabertoothEmulator.
+  \param baud The emulated baud rate.
+  */
+  USBSabertoothEmulator(uint32_t baud = 9600);
+  
+public:
+  inline uint32_t baud() const { return _baud; }
+         void     setBaud(uint32_t baud);
+  
+  /*!
+  Sets which addresses answer.
+  \param mask Bit i set for address 128 + i.
+  */
+  inline void setAddresses(byte mask) { _addresses = mask; }
+  
+  /*!
+  Sets how long the drivers take to start replying once a get is in.
+  Replies of different drivers overlapping on the line are garbled and counted by collisions().
+  \param micros The turnaround, in microseconds.
+  */
+  inline void setTurnaroundMicros(uint32_t micros) { _turnaroundMicros = micros; }
+  
+  /*!
+  Emulates a cable that is clean up to some baud rate and gets worse above it.
+  Above cleanBaud, each byte in either direction has one bit flipped with a chance of
+  perMille / 1000 for every cleanBaud over it, so errors grow with the baud rate.
+  \param cleanBaud The fastest baud rate without errors, 0 for a clean line at any rate.
+  \param perMille  The error chance per byte, in thousandths, per cleanBaud over it.
+  \param seed      The seed of the error pattern, the same seed gives the same errors.
+  */
+  void setNoise(uint32_t cleanBaud, uint16_t perMille, uint32_t seed = 1);
+  
+  /*!
+  Sets the emulated readings.
+  \param battery     The battery reading.
+  \param temperature The temperature reading.
+  \param fullCurrent The current reading at full motor output, 2047.
+  */
+  void setReadings(int battery, int temperature, int fullCurrent);
+  
+  /*!
+  Gets the value last set on an output of an emulated driver.
+  \param address The driver address.
+  \param type    'M' or 'P'.
+  \param number  1 or 2.
+  */
+  int value(byte address, byte type, byte number) const;
+  
+  /*!
+  Clears the driver state, the line and the statistics.
+  */
+  void reset();
+  
+public:
+  inline uint32_t packets     () const { return _packets;      }  // valid packets received
+  inline uint32_t invalid     () const { return _invalid;      }  // corrupt or unknown packets received
+  inline uint32_t txBusyMicros() const { return _txBusyMicros; }  // time spent receiving from the library
+  inline uint32_t rxBusyMicros() const { return _rxBusyMicros; }  // time spent replying
+  inline uint32_t collisions  () const { return _collisions;   }  // replies garbled by another one
+  inline uint32_t corrupted   () const { return _corrupted;    }  // bytes hit by setNoise
+  
+public:
+  virtual int    available();
+  virtual int    read();
+  virtual int    peek();
+  virtual size_t write(uint8_t data);
+  using Print::write;
+  
+protected:
+  static uint32_t nowMicros();
+  void            packet(uint32_t arrival);
+  void            reply(uint32_t arrival, const byte* data, size_t length);
+  byte            noise(byte data);
+  
+protected:
+  uint32_t _baud, _byteMicros, _turnaroundMicros;
+  uint32_t _cleanBaud, _seed;
+  uint16_t _noisePerMille;
+  byte     _addresses, _rxAddress;
+  int16_t  _values[8][4];   // M1, M2, P1, P2 of each address
+  int16_t  _battery, _temperature, _fullCurrent;
+  
+  byte     _packet[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+  byte     _packetLength;
+  uint32_t _txFree, _rxFree;
+  
+  byte     _queue[SABERTOOTH_EMULATOR_QUEUE_LENGTH];
+  uint32_t _queueTime[SABERTOOTH_EMULATOR_QUEUE_LENGTH];
+  byte     _queueStart, _queueLength;
+  
+  uint32_t _packets, _invalid, _txBusyMicros, _rxBusyMicros, _collisions, _corrupted;
+};
+
+/*!
+\class USBSabertoothRing
+\brief Fixed size single-producer/single-consumer ring.
+       push() may only be called from one context and pop() from one other context.
+       Neither side ever blocks or takes a lock, so the two sides can live on different
+       threads (hosts) or in a loop and a cooperative task (MCUs).
+*/
+template <typename T, uint8_t N>
+class USBSabertoothRing
+{
+  static_assert(N > 0 && N <= 128 && (N & (N - 1)) == 0, "USBSabertoothRing length must be a power of two, 128 at most");
+  
+public:
+  USBSabertoothRing() : _head(0), _tail(0) {}
+  
+public:
+  inline uint8_t count() const { return (uint8_t)(__atomic_load_n(&_head, __ATOMIC_ACQUIRE) - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE)); }
+  inline boolean empty() const { return count() == 0; }
+  inline boolean full () const { return count() >= N; }
+  
+  boolean push(const T& item)   // producer side
+  {
+    uint8_t head = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+    if ((uint8_t)(head - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE)) >= N) { return false; }
+    _items[head & (N - 1)] = item;
+    __atomic_store_n(&_head, (uint8_t)(head + 1), __ATOMIC_RELEASE);
+    return true;
+  }
+  
+  boolean peek(T* item) const   // consumer side
+  {
+    uint8_t tail = __atomic_load_n(&_tail, __ATOMIC_RELAXED);
+    if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE)) { return false; }
+    *item = _items[tail & (N - 1)];
+    return true;
+  }
+  
+  boolean pop(T* item)          // consumer side
+  {
+    if (!peek(item)) { return false; }
+    __atomic_store_n(&_tail, (uint8_t)(__atomic_load_n(&_tail, __ATOMIC_RELAXED) + 1), __ATOMIC_RELEASE);
+    return true;
+  }
+  
+private:
+  T       _items[N];
+  uint8_t _head, _tail;
+};
+
+/*!
+\struct USBSabertoothOperation
+\brief A set or get travelling through a USBSabertoothQueue, and its completion.
+*/
+struct USBSabertoothOperation
+{
+  byte                 address;
+  USBSabertoothCommand command;   // SABERTOOTH_CMD_SET or SABERTOOTH_CMD_GET
+  byte                 flags;     // set or get type, plus 2 for unscaled gets
+  byte                 type;
+  byte                 number;
+  boolean              crc;
+  int                  value;     // value to set, or get result (SABERTOOTH_GET_ERROR, SABERTOOTH_GET_TIMED_OUT) on completion
+  int                  context;
+};
+
+/*!
+\class USBSabertoothShadow
+\brief Remembers the last value sent to each output and setting of a motor driver:
+       M1, M2, MD, MT, P1, P2, Q1, Q2, R1, R2 and the shutdown of M1, M2, P1 and P2.
+       Attach it with USBSabertooth::setShadow to skip sets that would not change anything
+       and to re-assert the state after a driver reset or a lost packet. Setting M1 or M2
+       forgets MD and MT, and the other way around, so a refresh never brings back the mode
+       the application left.
+*/
+class USBSabertoothShadow
+{
+public:
+  /*!
+  Constructs a USBSabertoothShadow.
+  \param refreshIntervalMS The time between two background refreshes, see USBSabertooth::refresh.
+                           SABERTOOTH_INFINITE_TIMEOUT disables them.
+  */
+  USBSabertoothShadow(int32_t refreshIntervalMS = 1000);
+  
+public:
+  /*!
+  Gets the channel a set goes to.
+  \return The channel, or SABERTOOTH_SHADOW_CHANNELS if it is not mirrored.
+  */
+  static USBSabertoothShadowChannel channel(byte type, byte number, USBSabertoothSetType setType);
+  
+  inline boolean known(USBSabertoothShadowChannel channel) const { return (_known >> channel) & 1; }
+  inline int     value(USBSabertoothShadowChannel channel) const { return _values[channel]; }
+  
+  /*!
+  Forgets everything, for example when the driver is known to have been reset and
+  the application will send a complete new state.
+  */
+  inline void clear() { _known = 0; }
+  
+  inline int32_t getRefreshInterval() const { return _refresh.timeoutMS(); }
+  inline void    setRefreshInterval(int32_t intervalMS) { _refresh.setTimeoutMS(intervalMS); }
+  
+private:
+  friend class USBSabertooth;
+  void    record(USBSabertoothShadowChannel channel, int value);
+  boolean nextRefresh(USBSabertoothShadowChannel* channel);
+  
+private:
+  int16_t              _values[SABERTOOTH_SHADOW_CHANNELS];
+  uint16_t             _known;
+  byte                 _next;
+  USBSabertoothTimeout _refresh;
+};
+
+/*!
+\class USBSabertoothSerial
+\brief Create a USBSabertoothSerial for the serial port you are using, and then
+       attach a USBSabertooth for each motor driver you want to communicate with.
+*/
+class USBSabertoothSerial
+{
+  friend class USBSabertooth;
+  friend class USBSabertoothQueue;
+  friend class USBSabertoothArbiter;
+  friend class USBSabertoothBaudProbe;
+  friend class USBSabertoothScriptPlayer;
+  
+public:
+  /*!
+  Constructs a USBSabertoothSerial object.
+  \param port The serial port the motor driver is on.
+              By default, this is the Arduino TX pin.
+  */
+  USBSabertoothSerial(Stream& port = SabertoothTXPinSerial);
+  
+public:
+  /*!
+  Gets the serial port being used.
+  \return The serial port.
+  */
+  inline Stream& port() const { return _port; }
+
+  /*!
+  Checks whether a reply from any of the USBSabertooth async_get function calls is available. 
+  Always returns immediatelly, must be called repeadly until it returns true either with a response or an error. 
+  \param type (returned by reference) The type of channel to get from. See get function. Always updated
+  \param number (returned by reference) The number of the channel, 1 or 2. Always updated
+  \param getType (returned by reference) The Get command type. Always updated
+  \param result (returned by reference) The resulting value, SABERTOOTH_GET_ERROR, or SABERTOOTH_GET_TIMED_OUT. 
+        Only updated in case of success, i.e the funcion returning true, undefined otherwise
+  \return true if new data is available or the get command timed out, false otherwhise 
+  */
+  boolean reply_available( byte *type, byte *number, USBSabertoothGetType *getType, int *result, int *context );
+  boolean reply_available( byte *type, byte *number, int *result, int *context );
+  boolean reply_available( byte *number, int *result, int *context );
+  boolean reply_available( int *result, int *context );
+  
+  /*!
+  Feeds received bytes to the reply framer, for ports that are not read through the Stream,
+  such as DMA ring buffers or host event loops. The bytes are framed in place, call
+  reply_available afterwards to complete the get. Must be called from the same context as
+  reply_available. Bytes arriving while no get is in flight are discarded.
+  \param data   The received bytes.
+  \param length The number of received bytes.
+  \return The number of bytes consumed. Framing stops after a complete reply, so call again
+          with the rest once reply_available returned true.
+  */
+  size_t receive(const byte* data, size_t length);
+  
+  /*!
+  Gets how long reply_available can be left uncalled when no bytes arrive: until the next
+  polled get is due, or until the get in flight times out. Event loops use it to sleep,
+  for example as the epoll_wait or timerfd timeout, instead of busy polling.
+  \return The time in clock ticks, 0 if reply_available has work to do now,
+          or SABERTOOTH_INFINITE_TIMEOUT if only arriving bytes can make progress.
+  */
+  int32_t ticksUntilDue() const;
+  
+  /*!
+  Gets whether a reply is being waited for, that is, whether arriving bytes are useful now.
+  */
+  inline boolean awaitingReply() const { return _request.pending(); }
+  
+  /*!
+  Gives the get or sweep accepted with this context a deadline. A get still waiting for the
+  poll interval when the deadline passes is dropped without using the line; either way
+  reply_available returns SABERTOOTH_GET_TIMED_OUT at the deadline unless the reply came first.
+  A sweep ends at its deadline with the fields it has. The get timeout still applies.
+  \param context   The context the get was accepted with.
+  \param timeoutMS The deadline, in milliseconds from now.
+  \return true if the get or sweep is waiting or in flight, false if there is none with this context.
+  */
+  inline boolean setDeadline(int context, int32_t timeoutMS) { return setDeadlineTicks(context, USBSabertoothTimeout::ticksFromMS(timeoutMS)); }
+  boolean setDeadlineTicks(int context, int32_t ticks);
+  
+  /*!
+  Cancels the get or sweep accepted with this context, or stops polling it again.
+  A get still waiting for the poll interval is dropped without using the line. A get already
+  sent can not be called back: its reply is awaited and discarded, for at most the get timeout,
+  and new gets are accepted once it is through. reply_available reports nothing for it.
+  \param context The context the get was accepted with.
+  \return true if cancelled, false if there is no get or sweep with this context.
+  */
+  boolean cancel(int context);
+  
+  /*!
+  Bounds the work done by each reply_available call, so a noisy or flooded line can not
+  hold up the caller. Reading stops when either limit is reached and resumes on the next call.
+  \param maxBytes The most bytes read per call, 0 for no limit.
+  \param maxTicks The most clock ticks spent reading per call, 0 for no limit.
+                  See USBSabertoothTimeout for the tick unit.
+  */
+  void setBudget(uint16_t maxBytes, uint16_t maxTicks = 0);
+  
+  /*!
+  Gets the poll interval.
+  \return The poll interval, in milliseconds.
+  */
+  inline int32_t getPollInterval() const { return _poll.timeoutMS(); }
+  
+  /*!
+  Sets the poll interval.
+  \param timeoutMS The poll interval, in milliseconds.
+  */
+  inline void setPollInterval(int32_t timeoutMS) { _poll.setTimeoutMS(timeoutMS); }
+
+  /*!
+  Gets the get timeout.
+  \return The get timeout, in milliseconds.
+  */
+  inline int32_t getGetTimeout() const { return _request.timeoutMS(); }
+  
+  /*!
+  Sets the get timeout.
+  \param timeoutMS The get timeout, in milliseconds.
+  */
+  inline void setGetTimeout(int32_t timeoutMS) { _request.setTimeoutMS(timeoutMS); }
+
+  /*!
+  Gets the poll interval in clock ticks, see USBSabertoothTimeout.
+  \return The poll interval, in ticks.
+  */
+  inline int32_t getPollIntervalTicks() const { return _poll.timeoutTicks(); }
+  
+  /*!
+  Sets the poll interval in clock ticks, allowing sub millisecond intervals
+  when the library is built with SABERTOOTH_CLOCK_MICROS.
+  \param ticks The poll interval, in ticks.
+  */
+  inline void setPollIntervalTicks(int32_t ticks) { _poll.setTimeoutTicks(ticks); }
+  
+  /*!
+  Gets the get timeout in clock ticks, see USBSabertoothTimeout.
+  \return The get timeout, in ticks.
+  */
+  inline int32_t getGetTimeoutTicks() const { return _request.timeoutTicks(); }
+  
+  /*!
+  Sets the get timeout in clock ticks.
+  \param ticks The get timeout, in ticks.
+  */
+  inline void setGetTimeoutTicks(int32_t ticks) { _request.setTimeoutTicks(ticks); }
+
+  /*!
+  Logs every packet sent and received to a capture, or stops logging.
+  \param capture The capture, or NULL to stop.
+  */
+  inline void setCapture(USBSabertoothCapture* capture) { _capture = capture; }
+
+private:
+  void    write    (byte address, USBSabertoothCommand command, boolean useCRC, const byte* data, size_t lengthOfData);
+  void    writePacket(const byte* buffer, size_t length);
+  static size_t encodeSet(byte* buffer, byte address, boolean useCrc, byte type, byte number, int value, USBSabertoothSetType setType);
+  void    set      (byte address, boolean useCrc, byte type, byte number, int value, USBSabertoothSetType setType);
+#if !SABERTOOTH_NO_SYNC_GET
+  int     get      (byte address, boolean useCrc, byte type, byte number, USBSabertoothGetType getType, boolean unescaled);
+#endif
+  boolean async_get(byte address, boolean useCrc, byte type, byte number, USBSabertoothGetType getType, int context, boolean unescaled);
+  boolean async_sweep(byte address, boolean useCrc, USBSabertoothTelemetry* snapshot, byte fields, int context, boolean unscaled);
+  boolean nextSweepRequest();
+  void    finishSweep(int* result, int* context);
+  void    prepareRequest(byte address, boolean useCrc, byte type, byte number, USBSabertoothGetType getType, int context, boolean unscaled);
+  void    sendRequest();
+  boolean tryReceivePacket();
+  void    captureReply(const USBSabertoothReplyReceiver& receiver);
+  boolean clearSerial();
+  boolean withinBudget(uint16_t bytes, USBSabertoothTicks start) const;
+
+private:
+  USBSabertoothSerial(USBSabertoothSerial& serial); // no copy
+  void operator =    (USBSabertoothSerial& serial);
+
+private:
+  USBSabertoothReplyReceiver _receiver;
+  USBSabertoothRequest       _request;
+  USBSabertoothTimeout       _poll;
+  Stream&                    _port;
+  USBSabertoothCapture*      _capture;
+  USBSabertoothTelemetry*    _sweep;
+  uint16_t                   _budgetBytes, _budgetTicks;
+  boolean                    _clearing SABERTOOTH_BIT;
+  boolean                    _idle     SABERTOOTH_BIT;   // no get to send or poll again
+  boolean                    _resume   SABERTOOTH_BIT;   // a sweep get to send once clearing is done
+};
+
+class USBSabertoothSampler;
+
+/*!
+\class USBSabertooth
+\brief Controls a USB Sabertooth motor driver running in Packet Serial mode.
+*/
+class USBSabertooth
+{
+public:
+  /*!
+  Initializes a new instance of the USBSabertooth class.
+  The driver address is set to the value given, and the specified serial port is used.
+  \param serial The USBSabertoothSerial whose serial port the motor driver is on.
+  \param address The driver address.
+  */
+  USBSabertooth(USBSabertoothSerial& serial, byte address);
+  
+public:
+  /*!
+  Gets the driver address.
+  \return The driver address.
+  */
+  inline byte address() const { return _address; }
+
+  /*!
+  Sends a packet serial command to the motor driver.
+  \param command The number of the command.
+  \param value   The command's value.
+  */
+  void command(USBSabertoothCommand cmd, byte value);
+  
+  /*!
+  Sends a multibyte packet serial command to the motor driver.
+  \param command The number of the command.
+  \param value   The command's value.
+  \param bytes   The number of bytes in the value.
+  */
+  void command(USBSabertoothCommand cmd, const byte* value, size_t bytes);
+  
+public:
+  /*!
+  Controls motor output 1.
+  In User Mode, this sets M1.
+  \param value The value, between -2047 and 2047.
+  */
+  void motor(int value);
+  
+  /*!
+  Controls the specified motor output.
+  In User Mode, this sets M1 or M2.
+  \param motorOutputNumber The motor output number, 1 or 2.
+                           You can also use a character, such as '3', to select the
+                           motor output by its Plain Text Serial address.
+  \param value             The value, between -2047 and 2047.
+  */
+  void motor(byte motorOutputNumber, int value);
+  
+  /*!
+  Controls power output 1, if power output 1 is configured as a controllable output.
+  In User Mode, this sets P1.
+  \param value The value, between -2047 and 2047.
+  */
+  void power(int value);
+  
+  /*!
+  Controls the specified power output, if the power output is configured as a controllable output.
+  In User Mode, this sets P1 or P2.
+  \param powerOutputNumber The power output number, 1 or 2.
+                           You can also use a character, such as '3', to select the
+                           power output by its Plain Text Serial address.
+  \param value             The value, between -2047 and 2047.
+  */
+  void power(byte powerOutputNumber, int value);
+  
+  /*!
+  Controls the mixed-mode drive channel.
+  In User Mode, this sets MD.
+  \param value The value, between -2047 and 2047.
+  */
+  void drive(int value);
+  
+  /*!
+  Controls the mixed-mode turn channel.
+  In User Mode, this sets MT.
+  \param value The value, between -2047 and 2047.
+  */
+  void turn(int value);
+  
+  /*!
+  Causes motor output 1 to freewheel.
+  In User Mode, this sets Q1.
+  \param value  true or a positive value lets the motor outputs freewheel.
+                false or a negative or zero value stops the freewheeling.
+  */
+  void freewheel(int value = 2048);
+  
+  /*!
+  Causes the specified motor output to freewheel.
+  In User Mode, this sets Q1 or Q2.
+  \param motorOutputNumber The motor output number, 1 or 2.
+                           You can also use a character, such as '3', to select the
+                           motor output by its Plain Text Serial address.
+  \param value             true or a positive value lets the motor output freewheel.
+                           false or a negative or zero value stops the freewheeling.
+  */
+  void freewheel(byte motorOutputNumber, int value = 2048);
+  
+  /*!
+  Shuts down an output.
+  \param type   The type of output to shut down. This can be
+                'M' (motor output) or
+                'P' (power output).
+  \param number The number of the output, 1 or 2.
+                You can also use a character, such as '3', to select by
+                Plain Text Serial address.
+  \param value  true sets the shutdown.
+                false clears the shutdown.
+  */
+  void shutDown(byte type, byte number, boolean value = true);
+  
+public:
+  /*!
+  Sets a value on the motor driver.
+  \param type   The type of channel to set. This can be
+                'M' (motor output),
                 'P' (power output),
                 'Q' (freewheel), or
                 'R' (ramping).
@@ -400,179 +1344,1088 @@ public:
   \param value  The value, between -16383 and 16383
                 (though in many cases, only -2047 to 2047 are meaningful).
   */
-  void set(byte type, byte number, int value);
+  void set(byte type, byte number, int value);
+  
+  /*!
+  Sets the ramping for all motor outputs.
+  In User Mode, this sets R1 and R2.
+  \param value The ramping value, between -16383 (fast) and 2047 (slow).
+  */
+  void setRamping(int value);
+  
+  /*!
+  Sets the ramping for the specified motor output.
+  In User Mode, this sets R1 or R2.
+  \param motorOutputNumber The motor output number, 1 or 2.
+                           You can also use a character, such as '3', to select the
+                           motor output by its Plain Text Serial address.
+  \param value             The ramping value, between -16383 (fast) and 2047 (slow).
+  */
+  void setRamping(byte motorOutputNumber, int value);
+    
+  /*!
+  Sets the serial timeout.
+  \param milliseconds The maximum time in milliseconds between packets.
+                      If this time is exceeded, the driver will stop the
+                      motor and power outputs.
+                      A value of zero uses the DEScribe setting.
+                      SABERTOOTH_INFINITE_TIMEOUT disables the timeout.
+  */
+  void setTimeout(int milliseconds);
+  
+  /*!
+  Resets the serial timeout.
+  This is done automatically any time a motor output is set.
+  You can, however, call this if you don't want to set any motor outputs.
+  */
+  void keepAlive();
+  
+public:
+  /*!
+  Mirrors every value sent from now on into a shadow, or stops mirroring.
+  \param shadow The shadow, or NULL.
+  */
+  inline void setShadow(USBSabertoothShadow* shadow) { _shadow = shadow; }
+  
+  /*!
+  Gets the shadow.
+  \return The shadow, or NULL if none was set.
+  */
+  inline USBSabertoothShadow* shadow() const { return _shadow; }
+  
+  /*!
+  Tells a sampler about every motor set from now on, so it samples faster right after
+  a setpoint change, or stops telling.
+  \param sampler The sampler, or NULL.
+  */
+  inline void setSampler(USBSabertoothSampler* sampler) { _sampler = sampler; }
+  
+  /*!
+  Sets a value only if it differs from the one last sent. Without a shadow, it is always sent.
+  \param type   See set.
+  \param number See set.
+  \param value  See set.
+  \return true if the value was sent.
+  */
+  boolean update(byte type, byte number, int value);
+  
+  /*!
+  Re-asserts the state remembered by the shadow, one channel per refresh interval, in turns.
+  Call it from loop(); it returns immediatelly and does nothing without a shadow.
+  */
+  void refresh();
+  
+  /*!
+  Re-sends the whole state remembered by the shadow at once.
+  */
+  void resendAll();
+  
+public: 
+#if !SABERTOOTH_NO_SYNC_GET
+  /*!
+  Gets a value from the motor driver.
+  \param type  The type of channel to get from. This can be
+                'S' (signal),
+                'A' (aux),
+                'M' (motor output), or
+                'P' (power output).
+  \param number The number of the channel, 1 or 2.
+                You can also use a character, such as '3', to select by
+                Plain Text Serial address.
+  \return The value, or SABERTOOTH_GET_TIMED_OUT.
+  */
+  inline int get(byte type, byte number)
+  {
+    return get(type, number, SABERTOOTH_GET_VALUE, false);
+  }
+
+  /*!
+  Gets the battery voltage.
+  \param motorOutputNumber The number of the motor output, 1 or 2.
+                           You can also use a character, such as '3', to select by
+                           Plain Text Serial address.
+  \param unscaled          If true, gets in unscaled units. If false, gets in scaled units.
+  \return The value, or SABERTOOTH_GET_TIMED_OUT.
+  */
+  inline int getBattery(byte motorOutputNumber, boolean unscaled = false)
+  {
+    return get('M', motorOutputNumber, SABERTOOTH_GET_BATTERY, unscaled);
+  }
+  
+  /*!
+  Gets the motor output current.
+  \param motorOutputNumber The number of the motor output, 1 or 2.
+                           You can also use a character, such as '3', to select by
+                           Plain Text Serial address.
+  \param unscaled          If true, gets in unscaled units. If false, gets in scaled units.
+  \return The value, or SABERTOOTH_GET_TIMED_OUT.
+  */
+  inline int getCurrent(byte motorOutputNumber, boolean unscaled = false)
+  {
+    return get('M', motorOutputNumber, SABERTOOTH_GET_CURRENT, unscaled);
+  }
+  
+  /*!
+  Gets the motor output temperature.
+  \param motorOutputNumber The number of the motor output, 1 or 2.
+                           You can also use a character, such as '3', to select by
+                           Plain Text Serial address.
+  \param unscaled          If true, gets in unscaled units. If false, gets in scaled units.
+  \return The value, or SABERTOOTH_GET_TIMED_OUT.
+  */
+  inline int getTemperature(byte motorOutputNumber, boolean unscaled = false)
+  {
+    return get('M', motorOutputNumber, SABERTOOTH_GET_TEMPERATURE, unscaled);
+  }
+#endif
+
+  /*!
+  Asynchronous, non blocking, get functions. After calling one of these, use one of the 'reply_available'
+  methods of the USBSabertoothSerial to get the response.
+  \param type    See get method.
+  \param number  See get method.
+  \param context Any arbitrary number. It will be returned by 'reply_available' upon reception of the response
+  \return true if the get command was sent, false if still waiting response from the previous call. 
+        These functions will always return immediatelly
+  */
+
+  inline boolean async_get(byte type, byte number, int context=0) {
+    return async_get(type, number, SABERTOOTH_GET_VALUE, context, false);
+  }
+
+  inline boolean async_getBattery(byte motorOutputNumber, int context=0, boolean unscaled = false) {
+    return async_get('M', motorOutputNumber, SABERTOOTH_GET_BATTERY, context, unscaled);
+  }
+  
+  inline boolean async_getCurrent(byte motorOutputNumber, int context=0, boolean unscaled = false) {
+    return async_get('M', motorOutputNumber, SABERTOOTH_GET_CURRENT, context, unscaled);
+  }
+  
+  inline boolean async_getTemperature(byte motorOutputNumber, int context=0, boolean unscaled=false ) {
+    return async_get('M', motorOutputNumber, SABERTOOTH_GET_TEMPERATURE, context, unscaled);
+  }
+  
+  /*!
+  Starts a telemetry sweep: the selected fields are requested back to back, without waiting
+  for the poll interval between them, and stored in the snapshot. reply_available returns
+  true once, when the sweep is done, with the context given here and the mask of the valid
+  fields as result. Fields that timed out or failed are left out of the mask.
+  \param snapshot The snapshot to fill. It must stay alive until the sweep is done.
+  \param context  Any arbitrary number, returned by 'reply_available' at the end of the sweep.
+  \param fields   Mask of the fields to get, (1 << USBSabertoothTelemetryField) each.
+  \param unscaled If true, gets in unscaled units.
+  \return true if the sweep was started, false if a get or another sweep is in progress.
+  */
+  inline boolean async_getTelemetry(USBSabertoothTelemetry* snapshot, int context = 0,
+                                    byte fields = SABERTOOTH_TELEMETRY_ALL, boolean unscaled = false) {
+    return _serial.async_sweep(_address, _crc, snapshot, fields, context, unscaled);
+  }
+  
+public:
+  /*! Gets the get retry interval.
+  \return The get retry interval, in milliseconds.
+  */
+  //inline int32_t getGetRetryInterval() const { return _getRetryInterval; }
+  
+  /*!
+  Sets the get retry interval.
+  \param intervalMS The command retry interval, in milliseconds.
+  */
+  //inline void setGetRetryInterval(int32_t intervalMS) { _getRetryInterval = intervalMS; }
+
+  /*!
+  Gets the get timeout. DEPRECATED, use the USBSabertoothSerial functions instead
+  \return The get timeout, in milliseconds.
+  */
+  inline int32_t getGetTimeout() const { return _serial._request.timeoutMS(); }
+  
+  /*!
+  Sets the get timeout. DEPRECATED, use the USBSabertoothSerial functions instead
+  \param timeoutMS The get timeout, in milliseconds.
+  */
+  inline void setGetTimeout(int32_t timeoutMS) { _serial._request.setTimeoutMS(timeoutMS); }
+
+  /*!
+  Sets the conversion of this driver's unscaled readings to engineering units.
+  \param units The conversion, or NULL.
+  */
+  inline void setUnits(const USBSabertoothUnits* units) { _units = units; }
+  
+  /*!
+  Gets the conversion of this driver's unscaled readings to engineering units.
+  \return The conversion, or NULL if none was set.
+  */
+  inline const USBSabertoothUnits* units() const { return _units; }
+  
+  /*!
+  Gets whether CRC-protected commands are used. They are, by default.
+  \return True if CRC-protected commands are used.
+  */  
+  inline boolean usingCRC() const { return  SABERTOOTH_USE_CRC(_crc); }
+  
+  /*!
+  Causes future commands to be sent CRC-protected (larger packets, excellent error detection).
+  */
+  inline void useChecksum() { _crc = false; }
+  
+  /*!
+  Causes future commands to be sent checksum-protected (smaller packets, reasonable error detection).
+  */
+  inline void useCRC() { _crc = true ; }
+  
+private:
+#if !SABERTOOTH_NO_SYNC_GET
+  int get(byte type, byte number,
+          USBSabertoothGetType getType, boolean unscaled);
+#endif
+  
+  boolean async_get(byte type, byte number,
+          USBSabertoothGetType getType, int context, boolean unscaled);
+          
+  void set(byte type, byte number, int value,
+            USBSabertoothSetType setType);
+  
+  void resend(USBSabertoothShadowChannel channel);
+  
+private:
+  const byte                _address;
+  boolean                   _crc SABERTOOTH_BIT;
+  USBSabertoothSerial&      _serial;
+  const USBSabertoothUnits* _units;
+  USBSabertoothShadow*      _shadow;
+  USBSabertoothSampler*     _sampler;
+};
+
+/*!
+\class USBSabertoothQueue
+\brief Decouples the application from the serial I/O.
+       The application submits sets and gets and collects completions, the I/O side calls
+       service() and is the only one touching the USBSabertoothSerial and its port.
+       On hosts service() can run on a dedicated I/O thread, on MCUs from yield() or any
+       other cooperative task. Both directions are lock free USBSabertoothRing's.
+*/
+class USBSabertoothQueue
+{
+public:
+  /*!
+  Constructs a USBSabertoothQueue.
+  \param serial The USBSabertoothSerial owned by the I/O side.
+  */
+  USBSabertoothQueue(USBSabertoothSerial& serial);
+  
+public:
+  /*!
+  Queues a set. Application side.
+  \param driver  The motor driver to send the set to.
+  \param type    See USBSabertooth::set.
+  \param number  See USBSabertooth::set.
+  \param value   See USBSabertooth::set.
+  \param setType The set type.
+  \return true if queued, false if SABERTOOTH_QUEUE_LENGTH sets are already waiting.
+  */
+  boolean submitSet(const USBSabertooth& driver, byte type, byte number, int value,
+                    USBSabertoothSetType setType = SABERTOOTH_SET_VALUE);
+  
+  /*!
+  Queues a get. Application side. Its result is later returned by completion().
+  \param driver   The motor driver to get from.
+  \param type     See USBSabertooth::get.
+  \param number   See USBSabertooth::get.
+  \param getType  The get type.
+  \param context  Any arbitrary number, returned with the completion.
+  \param unscaled If true, gets in unscaled units.
+  \return true if queued, false if SABERTOOTH_QUEUE_LENGTH gets are already waiting.
+  */
+  boolean submitGet(const USBSabertooth& driver, byte type, byte number,
+                    USBSabertoothGetType getType, int context = 0, boolean unscaled = false);
+  
+  /*!
+  Collects the next completed get. Application side. Always returns immediatelly.
+  \param operation (returned by reference) The completed get, its result is in value.
+  \return true if a completion was available.
+  */
+  inline boolean completion(USBSabertoothOperation* operation) { return _completions.pop(operation); }
+  
+  /*!
+  Sends queued operations and collects replies. I/O side. Always returns immediatelly.
+  Sets and gets have their own rings: every waiting set is sent on each call, so sets never
+  wait behind a get in flight and go out ahead of queued gets. Gets are sent in submission
+  order, each one once the previous one is completed.
+  */
+  void service();
+  
+private:
+  USBSabertoothSerial&                                        _serial;
+  USBSabertoothRing<USBSabertoothOperation, SABERTOOTH_QUEUE_LENGTH> _sets, _gets, _completions;
+  USBSabertoothOperation                                      _current;
+  boolean                                                     _busy, _done;
+};
+
+/*!
+\class USBSabertoothArbiter
+\brief Overlapping gets to several motor drivers sharing one line.
+
+A USBSabertoothSerial keeps one get in flight, so on a shared line every get waits for the
+previous reply. Replies can not overlap on the line back, but their timing is known: a reply
+follows its get by the driver turnaround, and lasts its length at the baud rate. The arbiter
+sends the next get, to another driver, as soon as its reply can only start after every reply
+still outstanding has ended, and matches replies back by address, type and number.
+
+While it is in use, make gets on its USBSabertoothSerial through the arbiter only;
+sets through the USBSabertooth objects are fine.
+*/
+class USBSabertoothArbiter
+{
+public:
+  /*!
+  Constructs a USBSabertoothArbiter.
+  \param serial The USBSabertoothSerial of the shared line.
+  \param baud   The baud rate of the line.
+  */
+  USBSabertoothArbiter(USBSabertoothSerial& serial, uint32_t baud);
+  
+public:
+  /*!
+  Queues a get. It is sent once no reply outstanding can collide with its own.
+  \param driver   The motor driver to get from.
+  \param type     See USBSabertooth::get.
+  \param number   See USBSabertooth::get.
+  \param getType  The get type.
+  \param context  Any arbitrary number, returned with the reply.
+  \param unscaled If true, gets in unscaled units.
+  \return true if queued, false if SABERTOOTH_ARBITER_SLOTS gets are already held.
+  */
+  boolean async_get(const USBSabertooth& driver, byte type, byte number, USBSabertoothGetType getType,
+                    int context = 0, boolean unscaled = false);
+  
+  /*!
+  Sends the gets whose turn has come and checks for a reply. Always returns immediatelly,
+  call it repeatedly. Replies are returned as they arrive, not in the order of the gets.
+  Reading is bounded by the budget set with setBudget on the USBSabertoothSerial.
+  \param address (returned by reference) The address of the driver that replied.
+  \param type    (returned by reference) The type of the get.
+  \param number  (returned by reference) The number of the get.
+  \param result  (returned by reference) The value, or SABERTOOTH_GET_TIMED_OUT.
+  \param context (returned by reference) The context of the get, also when it timed out.
+  \return true if a get completed.
+  */
+  boolean reply_available(byte* address, byte* type, byte* number, int* result, int* context);
+  boolean reply_available(int* result, int* context);
+  
+  /*!
+  Sets the baud rate of the line.
+  */
+  void setBaud(uint32_t baud);
+  
+  /*!
+  Sets how long the drivers take to start replying once a get is in, in clock ticks.
+  The wider the range, the more room is left between replies.
+  \param minTicks The shortest turnaround.
+  \param maxTicks The longest turnaround.
+  */
+  inline void setTurnaroundTicks(uint16_t minTicks, uint16_t maxTicks) { _turnMin = minTicks; _turnMax = maxTicks; }
+  
+  inline int32_t getGetTimeout() const { return _timeout.timeoutMS(); }
+  inline void    setGetTimeout(int32_t timeoutMS) { _timeout.setTimeoutMS(timeoutMS); }
+  
+  /*!
+  Gives the gets queued with this context a deadline. A get not sent by then is dropped without
+  using the line, and reply_available returns SABERTOOTH_GET_TIMED_OUT for it at the deadline
+  unless its reply came first.
+  \param context   The context the gets were queued with.
+  \param timeoutMS The deadline, in milliseconds from now.
+  \return true if any get has this context.
+  */
+  inline boolean setDeadline(int context, int32_t timeoutMS) { return setDeadlineTicks(context, USBSabertoothTimeout::ticksFromMS(timeoutMS)); }
+  boolean setDeadlineTicks(int context, int32_t ticks);
+  
+  /*!
+  Cancels the gets queued with this context. Those not sent yet are dropped without using the
+  line, the replies of the others are discarded when they come. reply_available reports nothing for them.
+  \param context The context the gets were queued with.
+  \return true if any get had this context.
+  */
+  boolean cancel(int context);
+  
+public:
+  inline uint32_t sent      () const { return _sent;       }  // gets sent
+  inline uint32_t overlapped() const { return _overlapped; }  // gets sent while other replies were outstanding
+  inline uint32_t mismatches() const { return _mismatches; }  // replies matching no get
+  
+private:
+  USBSabertoothTicks lineTicks(byte bytes) const;
+  void               sendDue();
+  void               complete(byte index, byte* address, byte* type, byte* number, int* context);
+  void               remove(byte index);
+  
+private:
+  USBSabertoothSerial&       _serial;
+  USBSabertoothReplyReceiver _receiver;
+  USBSabertoothRequest       _slots[SABERTOOTH_ARBITER_SLOTS];
+  byte                       _order[SABERTOOTH_ARBITER_SLOTS];   // slots in use, oldest first
+  byte                       _count;
+  USBSabertoothTimeout       _timeout;
+  USBSabertoothTicks         _txFree, _rxFree;   // when the lines are expected to be free
+  uint32_t                   _baud;
+  uint16_t                   _turnMin, _turnMax;
+  uint32_t                   _sent, _overlapped, _mismatches;
+};
+
+/*!
+\class USBSabertoothSampler
+\brief Polls readings as often as they change.
+
+Each channel is one reading of one driver, such as the motor 1 current. When a reading
+moves by more than the threshold of its get type, the time until its next get is halved,
+down to the fastest interval; while it is stable, the time grows by a quarter each get,
+up to the slowest interval. A motor set through a USBSabertooth attached with
+USBSabertooth::setSampler makes all its channels sample at the fastest interval again.
+
+The sampler makes the gets on its USBSabertoothSerial; do not make other gets there.
+Gets are also spaced by the serial poll interval, keep it shorter than the fastest interval.
+*/
+class USBSabertoothSampler
+{
+public:
+  /*!
+  Constructs a USBSabertoothSampler, with defaults suited to each get type.
+  \param serial The USBSabertoothSerial the drivers are on.
+  */
+  USBSabertoothSampler(USBSabertoothSerial& serial);
+  
+public:
+  /*!
+  Sets how a get type is sampled.
+  \param getType    The get type.
+  \param fastestMS  The shortest time between two gets of a channel, in milliseconds.
+  \param slowestMS  The longest time between two gets of a channel, in milliseconds.
+  \param threshold  The smallest change that counts as moving.
+  */
+  void configure(USBSabertoothGetType getType, int32_t fastestMS, int32_t slowestMS, int threshold);
+  
+  /*!
+  Adds a channel.
+  \param driver  The motor driver.
+  \param getType The get type.
+  \param number  The motor output number, 1 or 2.
+  \return The channel number, or -1 if SABERTOOTH_SAMPLER_CHANNELS are already there.
+  */
+  int add(USBSabertooth& driver, USBSabertoothGetType getType, byte number = 1);
+  
+  /*!
+  Sends the get of the channel most overdue and collects its reply. Always returns immediatelly.
+  \param channel (returned by reference) The channel that got a new reading.
+  \return true if a channel got a new reading.
+  */
+  boolean run(byte* channel);
+  
+  /*!
+  Makes the channels of a driver sample at their fastest. Called by USBSabertooth on motor sets.
+  \param driver The motor driver.
+  \param number The motor output number, or 'D' / 'T' for drive and turn.
+  \param value  The new setpoint.
+  */
+  void setpoint(const USBSabertooth& driver, byte number, int value);
+  
+public:
+  inline int      value   (byte channel) const { return _channels[channel].value; }
+  inline boolean  valid   (byte channel) const { return _channels[channel].valid; }
+  inline int32_t  interval(byte channel) const { return _channels[channel].interval / SABERTOOTH_TICKS_PER_MS; }   // ms
+  inline byte     channels() const { return _count; }
+  
+  inline uint32_t polls   () const { return _polls;    }  // gets sent
+  inline uint32_t baseline() const { return _baseline; }  // gets a fixed poll at the fastest interval would have sent
+  inline uint32_t errors  () const { return _errors;   }  // gets timed out or failed
+  
+private:
+  struct Config
+  {
+    USBSabertoothTicks fastest, slowest;
+    int16_t            threshold;
+  };
+  
+  struct Channel
+  {
+    USBSabertooth*     driver;
+    byte               getType, number;
+    int16_t            value, setpoints[2];   // own motor output or drive, and turn
+    USBSabertoothTicks due, interval, polled;
+    boolean            valid;
+  };
+  
+  static byte   configIndex(byte getType);
+  void          reading(Channel& channel, int result);
+  
+private:
+  USBSabertoothSerial& _serial;
+  Config               _configs[4];
+  Channel              _channels[SABERTOOTH_SAMPLER_CHANNELS];
+  byte                 _count, _current;
+  boolean              _busy;
+  uint32_t             _polls, _baseline, _errors;
+};
+
+/*!
+\class USBSabertoothCurrentLimiter
+\brief Keeps the motor currents of a driver under a limit.
+
+The limiter streams the current of each limited motor output through the async get path,
+one get after the other, and runs a fixed-point PI loop on every reading. The loop output
+is a scale from 0 to 65536 (full power) that is applied to the power given to motor().
+Whenever the scaled power changes it is sent right away, so the reaction time is about
+one get round trip per limited output.
+
+The limiter makes the gets on its USBSabertoothSerial; do not make other gets there, and
+set its poll interval to 0 for the fastest loop.
+*/
+class USBSabertoothCurrentLimiter
+{
+public:
+  /*!
+  Constructs a USBSabertoothCurrentLimiter. No output is limited until setLimit is called.
+  \param serial The USBSabertoothSerial the driver is on.
+  \param driver The motor driver.
+  */
+  USBSabertoothCurrentLimiter(USBSabertoothSerial& serial, USBSabertooth& driver);
+  
+public:
+  /*!
+  Limits the current of a motor output.
+  \param motorOutputNumber The motor output number, 1 or 2.
+  \param limit             The current limit, in the units of USBSabertooth::getCurrent.
+  */
+  void setLimit(byte motorOutputNumber, int limit);
+  
+  /*!
+  Stops limiting a motor output. Its power is sent unscaled from then on.
+  \param motorOutputNumber The motor output number, 1 or 2.
+  */
+  void clearLimit(byte motorOutputNumber);
+  
+  /*!
+  Sets the PI gains, in 1/65536 of full power per unit of current over or under the limit.
+  \param kp The proportional gain, applied to every reading.
+  \param ki The integral gain, accumulated over the readings.
+  */
+  inline void setGains(int32_t kp, int32_t ki) { _kp = kp; _ki = ki; }
+  
+  /*!
+  Sets the power of a motor output, scaled down as needed to keep its current under the limit.
+  \param motorOutputNumber The motor output number, 1 or 2.
+  \param power             The power, from -2047 to 2047.
+  */
+  void motor(byte motorOutputNumber, int power);
+  
+  /*!
+  Collects the current reading in flight, updates the loop and sends the next get.
+  Always returns immediatelly, call it as often as possible.
+  \return true if a reading was processed.
+  */
+  boolean run();
+  
+public:
+  inline int      current (byte motorOutputNumber) const { return _channels[(motorOutputNumber - 1) & 1].current; }
+  inline int32_t  scale   (byte motorOutputNumber) const { return _channels[(motorOutputNumber - 1) & 1].scale;   }
+  inline boolean  limiting(byte motorOutputNumber) const { return scale(motorOutputNumber) < 65536; }
+  inline uint32_t updates () const { return _updates; }   // readings processed
+  inline uint32_t errors  () const { return _errors;  }   // gets timed out or failed
+  
+private:
+  struct Channel
+  {
+    int16_t limit, requested, sent, current;
+    int32_t integral, scale;   // 0 to 65536
+    boolean enabled;
+  };
+  
+  void apply(byte index, boolean force = false);
+  
+private:
+  USBSabertoothSerial& _serial;
+  USBSabertooth&       _driver;
+  Channel              _channels[2];
+  int32_t              _kp, _ki;
+  byte                 _next;
+  boolean              _busy;
+  uint32_t             _updates, _errors;
+};
+
+/*!
+\struct USBSabertoothBaudResult
+\brief What a USBSabertoothBaudProbe measured at one baud rate.
+*/
+struct USBSabertoothBaudResult
+{
+  uint32_t baud;
+  uint16_t sent;       // gets sent
+  uint16_t replies;    // good replies
+  uint16_t rejects;    // replies failing their checksum or CRC
+  uint16_t timeouts;   // gets without a good reply
+};
+
+/*!
+Switches the line to a baud rate, see USBSabertoothBaudProbe.
+\param baud The new baud rate.
+\param user The user pointer given to the probe.
+*/
+typedef void (*USBSabertoothBaudSetter)(uint32_t baud, void* user);
+
+/*!
+\class USBSabertoothBaudProbe
+\brief Finds the fastest baud rate that works reliably on a line.
+
+For each candidate rate, the probe calls the baud setter, sends a number of battery gets
+to one driver, and counts good replies, replies failing their checksum or CRC, and gets
+left unanswered. The fastest rate whose share of good replies meets the threshold wins, and
+the setter is called a last time with it. The setter must switch both ends of the line:
+the port (for example Serial1.begin(baud)) and, if it is not autobauding, the driver.
+While probing, do not use the USBSabertoothSerial for anything else.
+*/
+class USBSabertoothBaudProbe
+{
+public:
+  /*!
+  Constructs a USBSabertoothBaudProbe.
+  \param serial The USBSabertoothSerial of the line.
+  \param driver The motor driver to send the gets to.
+  \param setter Switches the line to a baud rate.
+  \param user   Passed to the setter.
+  */
+  USBSabertoothBaudProbe(USBSabertoothSerial& serial, USBSabertooth& driver, USBSabertoothBaudSetter setter, void* user = NULL);
   
+public:
   /*!
-  Sets the ramping for all motor outputs.
-  In User Mode, this sets R1 and R2.
-  \param value The ramping value, between -16383 (fast) and 2047 (slow).
+  Starts probing.
+  \param rates      The candidate baud rates, in any order. The array must outlive the probe.
+  \param count      The number of rates, up to SABERTOOTH_PROBE_RATES.
+  \param gets       The gets sent at each rate.
+  \param minPercent The share of good replies, in percent, a rate needs to be chosen.
+  \param current    The baud rate the line is on now, set back if no rate is good enough.
+                    0 leaves the line at the last rate probed.
   */
-  void setRamping(int value);
+  void begin(const uint32_t* rates, byte count, uint16_t gets = 100, byte minPercent = 99, uint32_t current = 0);
   
   /*!
-  Sets the ramping for the specified motor output.
-  In User Mode, this sets R1 or R2.
-  \param motorOutputNumber The motor output number, 1 or 2.
-                           You can also use a character, such as '3', to select the
-                           motor output by its Plain Text Serial address.
-  \param value             The ramping value, between -16383 (fast) and 2047 (slow).
+  Carries on probing. Always returns immediatelly, call it until it returns true.
+  \return true once every rate was probed and the best one, or the current one, is set.
   */
-  void setRamping(byte motorOutputNumber, int value);
-    
+  boolean run();
+  
   /*!
-  Sets the serial timeout.
-  \param milliseconds The maximum time in milliseconds between packets.
-                      If this time is exceeded, the driver will stop the
-                      motor and power outputs.
-                      A value of zero uses the DEScribe setting.
-                      SABERTOOTH_INFINITE_TIMEOUT disables the timeout.
+  Prints the results as CSV lines: baud,sent,replies,rejects,timeouts,ok.
   */
-  void setTimeout(int milliseconds);
+  void printCSV(Print& out) const;
   
+public:
+  inline boolean                        done  () const { return _index >= _count; }
+  inline uint32_t                       best  () const { return _best; }   // 0 if no rate was good enough
+  inline byte                           count () const { return _count; }
+  inline const USBSabertoothBaudResult& result(byte index) const { return _results[index]; }
+  
+private:
+  boolean good(const USBSabertoothBaudResult& result) const;
+  void    tally();
+  
+private:
+  USBSabertoothSerial&       _serial;
+  USBSabertooth&             _driver;
+  USBSabertoothBaudSetter    _setter;
+  void*                      _user;
+  USBSabertoothPacketDecoder _decoder;
+  USBSabertoothBaudResult    _results[SABERTOOTH_PROBE_RATES];
+  byte                       _count, _index, _minPercent;
+  uint16_t                   _gets;
+  boolean                    _waiting;
+  USBSabertoothTimeout       _timer;
+  uint32_t                   _best, _current;
+};
+
+/*!
+Command script records.
+A command script is an array of SABERTOOTH_SCRIPT_RECORD_LENGTH byte records, usually in PROGMEM:
+\code
+const byte wave[] PROGMEM =
+{
+  SABERTOOTH_SCRIPT_MOTOR(   0, 128, 1,  1024),   // at once
+  SABERTOOTH_SCRIPT_MOTOR(   0, 129, 1, -1024),   // along with it
+  SABERTOOTH_SCRIPT_MOTOR( 500, 128, 1,     0),   // 500 ms later
+  SABERTOOTH_SCRIPT_MOTOR(   0, 129, 1,     0),
+  SABERTOOTH_SCRIPT_END  (1000)                   // ends 1 s later
+};
+\endcode
+Each record is delayed by delayMS from the previous one, up to 65535 ms. Its bytes are the delay
+(low byte first), the address, the set type and flags, the type, the number and the value (low
+byte first). Records are sent with CRC unless SABERTOOTH_SCRIPT_CHECKSUM is in the flags.
+An address of 0 ends the script.
+*/
+#define SABERTOOTH_SCRIPT_RECORD_LENGTH 8
+#define SABERTOOTH_SCRIPT_CHECKSUM      0x80
+
+#define SABERTOOTH_SCRIPT_SET(delayMS, address, type, number, value, flags) \
+  (byte)((delayMS) & 0xff), (byte)((uint16_t)(delayMS) >> 8), (byte)(address), (byte)(flags), \
+  (byte)(type), (byte)(number), (byte)((value) & 0xff), (byte)((uint16_t)(value) >> 8)
+
+#define SABERTOOTH_SCRIPT_MOTOR(delayMS, address, number, value) SABERTOOTH_SCRIPT_SET(delayMS, address, 'M', number, value, SABERTOOTH_SET_VALUE)
+#define SABERTOOTH_SCRIPT_POWER(delayMS, address, number, value) SABERTOOTH_SCRIPT_SET(delayMS, address, 'P', number, value, SABERTOOTH_SET_VALUE)
+#define SABERTOOTH_SCRIPT_DRIVE(delayMS, address, value)         SABERTOOTH_SCRIPT_SET(delayMS, address, 'M', 'D', value, SABERTOOTH_SET_VALUE)
+#define SABERTOOTH_SCRIPT_TURN(delayMS, address, value)          SABERTOOTH_SCRIPT_SET(delayMS, address, 'M', 'T', value, SABERTOOTH_SET_VALUE)
+#define SABERTOOTH_SCRIPT_END(delayMS)                           SABERTOOTH_SCRIPT_SET(delayMS, 0, 0, 0, 0, 0)
+
+/*!
+\class USBSabertoothScriptPlayer
+\brief Plays a command script of timed sets to the drivers on a line, without blocking.
+
+Each record is due at the start time plus the delays of all records up to it, so late calls
+to run() do not add up over the script. The packet of the next record is encoded as soon as
+the previous one is out, so once it is due run() only has to write it; the timing error is
+the time between two run() calls plus the time the port takes to accept the packet.
+Sets go straight to the serial, not through the USBSabertooth objects, so a shadow or
+sampler attached to them does not see them.
+*/
+class USBSabertoothScriptPlayer
+{
+public:
   /*!
-  Resets the serial timeout.
-  This is done automatically any time a motor output is set.
-  You can, however, call this if you don't want to set any motor outputs.
+  Constructs a USBSabertoothScriptPlayer.
+  \param serial The USBSabertoothSerial of the line the drivers are on.
   */
-  void keepAlive();
+  USBSabertoothScriptPlayer(USBSabertoothSerial& serial);
   
-public: 
+public:
   /*!
-  Gets a value from the motor driver.
-  \param type  The type of channel to get from. This can be
-                'S' (signal),
-                'A' (aux),
-                'M' (motor output), or
-                'P' (power output).
-  \param number The number of the channel, 1 or 2.
-                You can also use a character, such as '3', to select by
-                Plain Text Serial address.
-  \return The value, or SABERTOOTH_GET_TIMED_OUT.
+  Starts playing a script held in memory. The first record is due its delay from now.
+  \param script  The records.
+  \param length  The length of the script, in bytes.
+  \param progmem true if the script is in PROGMEM, false if it is in RAM.
+  \param loop    If true, the script starts over once it ends.
   */
-  inline int get(byte type, byte number)
-  {
-    return get(type, number, SABERTOOTH_GET_VALUE, false);
-  }
-
+  void play(const byte* script, size_t length, boolean progmem = true, boolean loop = false);
+  
   /*!
-  Gets the battery voltage.
-  \param motorOutputNumber The number of the motor output, 1 or 2.
-                           You can also use a character, such as '3', to select by
-                           Plain Text Serial address.
-  \param unscaled          If true, gets in unscaled units. If false, gets in scaled units.
-  \return The value, or SABERTOOTH_GET_TIMED_OUT.
+  Starts playing a script read from a stream, such as a file on an SD card or a host.
+  Records are read as their bytes become available, until an end record.
+  \param source The stream.
   */
-  inline int getBattery(byte motorOutputNumber, boolean unscaled = false)
-  {
-    return get('M', motorOutputNumber, SABERTOOTH_GET_BATTERY, unscaled);
-  }
+  void play(Stream& source);
   
   /*!
-  Gets the motor output current.
-  \param motorOutputNumber The number of the motor output, 1 or 2.
-                           You can also use a character, such as '3', to select by
-                           Plain Text Serial address.
-  \param unscaled          If true, gets in unscaled units. If false, gets in scaled units.
-  \return The value, or SABERTOOTH_GET_TIMED_OUT.
+  Stops playing. Nothing more is sent.
   */
-  inline int getCurrent(byte motorOutputNumber, boolean unscaled = false)
-  {
-    return get('M', motorOutputNumber, SABERTOOTH_GET_CURRENT, unscaled);
-  }
+  void stop();
   
   /*!
-  Gets the motor output temperature.
-  \param motorOutputNumber The number of the motor output, 1 or 2.
-                           You can also use a character, such as '3', to select by
-                           Plain Text Serial address.
-  \param unscaled          If true, gets in unscaled units. If false, gets in scaled units.
-  \return The value, or SABERTOOTH_GET_TIMED_OUT.
+  Sends the sets that are due. Always returns immediatelly, call it as often as possible.
+  \return true while the script is playing.
   */
-  inline int getTemperature(byte motorOutputNumber, boolean unscaled = false)
-  {
-    return get('M', motorOutputNumber, SABERTOOTH_GET_TEMPERATURE, unscaled);
-  }
+  boolean run();
+  
+public:
+  inline boolean  playing     () const { return _playing; }
+  inline uint32_t sent        () const { return _sent;    }   // sets sent since play()
+  inline uint32_t maxLateTicks() const { return _maxLate; }   // most clock ticks a set was sent after it was due
+  
+private:
+  boolean fetch();
+  
+private:
+  USBSabertoothScriptPlayer(USBSabertoothScriptPlayer& player); // no copy
+  void operator =          (USBSabertoothScriptPlayer& player);
+  
+private:
+  USBSabertoothSerial& _serial;
+  const byte*          _script;
+  Stream*              _source;
+  size_t               _length, _position;
+  uint32_t             _due, _cycleDue;
+  uint32_t             _sent, _maxLate;
+  byte                 _record[SABERTOOTH_SCRIPT_RECORD_LENGTH], _recordLength;
+  byte                 _packet[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH], _packetLength;
+  boolean              _progmem, _loop, _playing, _ready;
+};
+
+/*!
+A simulation event, see USBSabertoothSimulation::schedule.
+\param user The user pointer given when it was scheduled.
+*/
+typedef void (*USBSabertoothEvent)(void* user);
 
+/*!
+\class USBSabertoothSimulation
+\brief Runs application code and emulated lines on virtual time, reproducibly.
+
+While a simulation is begun, it is the clock of USBSabertoothTimeout, so every timeout,
+poll interval and USBSabertoothEmulator line moves on its virtual time and nothing else.
+Application code, typically loop(), runs as scheduled events: one-shot or periodic, with
+an optional random jitter on the period drawn from the seeded generator. run() jumps from
+one event to the next, so hours of operation take seconds, and two runs with the same seed,
+events and configuration behave exactly alike, down to the byte. Events due at the same
+time run in the order they were scheduled.
+*/
+class USBSabertoothSimulation
+{
+public:
   /*!
-  Asynchronous, non blocking, get functions. After calling one of these, use one of the 'reply_available'
-  methods of the USBSabertoothSerial to get the response.
-  \param type    See get method.
-  \param number  See get method.
-  \param context Any arbitrary number. It will be returned by 'reply_available' upon reception of the response
-  \return true if the get command was sent, false if still waiting response from the previous call. 
-        These functions will always return immediatelly
+  Constructs a USBSabertoothSimulation at time 0.
+  \param seed The seed of random() and of the jitter.
+  */
+  USBSabertoothSimulation(uint32_t seed = 1);
+  
+public:
+  /*!
+  Makes this simulation the clock. Begin only one simulation at a time.
+  */
+  void begin();
+  
+  /*!
+  Gives the clock back to millis() or micros().
   */
+  void end();
+  
+  /*!
+  Schedules an event.
+  \param event  The function to call.
+  \param user   Passed to the function.
+  \param delay  The time until the first call, in clock ticks.
+  \param period The time between calls, in clock ticks, 0 for a single call.
+  \param jitter The most time added at random to each period, in clock ticks.
+  \return true if scheduled, false if SABERTOOTH_SIMULATION_EVENTS are already waiting.
+  */
+  boolean schedule(USBSabertoothEvent event, void* user, uint32_t delay, uint32_t period = 0, uint32_t jitter = 0);
+  
+  /*!
+  Removes every waiting call of an event with this user pointer.
+  */
+  void cancel(USBSabertoothEvent event, void* user);
+  
+  /*!
+  Runs the events due over some time, then leaves the clock at its end.
+  \param ticks The time to simulate, in clock ticks, up to 2^32 - 1.
+  */
+  void run(uint32_t ticks);
+  
+  /*!
+  Draws a number from the seeded generator.
+  \param limit The number drawn is below it.
+  */
+  uint32_t random(uint32_t limit);
+  
+public:
+  inline uint32_t now   () const { return _now;    }
+  inline uint32_t events() const { return _events; }   // events run so far
+  
+private:
+  struct Entry
+  {
+    USBSabertoothEvent event;
+    void*              user;
+    uint32_t           time, period, jitter;
+  };
+  
+  static uint32_t clock();
+  
+private:
+  static USBSabertoothSimulation* _current;
+  Entry                           _entries[SABERTOOTH_SIMULATION_EVENTS];
+  byte                            _count;
+  uint32_t                        _now, _seed, _events;
+};
 
-  inline boolean async_get(byte type, byte number, int context=0) {
-    return async_get(type, number, SABERTOOTH_GET_VALUE, context, false);
-  }
+/*!
+\enum USBSabertoothTraceKind
+The trace points.
+*/
+enum USBSabertoothTraceKind
+{
+  SABERTOOTH_TRACE_QUEUE = 0,  /*!< A get was accepted. a: address, b: get type. */
+  SABERTOOTH_TRACE_SEND  = 1,  /*!< A get is being sent. a: address, b: get type. */
+  SABERTOOTH_TRACE_WRITE = 2,  /*!< A packet was written to the port, with its duration. a: address, b: command. */
+  SABERTOOTH_TRACE_READ  = 3,  /*!< Bytes were read from the port, with its duration. a: bytes, b: reply complete. */
+  SABERTOOTH_TRACE_FRAME = 4,  /*!< A reply was framed. a: address, b: command. */
+  SABERTOOTH_TRACE_REPLY = 5   /*!< A get was completed. a: result, b: context. */
+};
 
-  inline boolean async_getBattery(byte motorOutputNumber, int context=0, boolean unscaled = false) {
-    return async_get('M', motorOutputNumber, SABERTOOTH_GET_BATTERY, context, unscaled);
-  }
-  
-  inline boolean async_getCurrent(byte motorOutputNumber, int context=0, boolean unscaled = false) {
-    return async_get('M', motorOutputNumber, SABERTOOTH_GET_CURRENT, context, unscaled);
-  }
+#if SABERTOOTH_TRACE
+/*!
+\struct USBSabertoothTraceEvent
+\brief One recorded trace point.
+*/
+struct USBSabertoothTraceEvent
+{
+  uint32_t    time;       // clock ticks
+  uint16_t    duration;   // clock ticks, 0 for instants
+  byte        kind;
+  int16_t     a, b;
+  const void* object;     // the USBSabertoothSerial or USBSabertoothReplyReceiver, one trace row each
+};
+
+/*!
+\class USBSabertoothTrace
+\brief Timeline of the library's I/O, for finding where loop latency goes.
+
+Build with SABERTOOTH_TRACE set to 1 to record the trace points, otherwise they compile to
+nothing. The last SABERTOOTH_TRACE_LENGTH events are kept in a ring that any number of
+threads can record into without a lock. writeJSON() prints them as a Chrome trace
+(chrome://tracing, ui.perfetto.dev), one row per serial port and receiver. Use it while
+nothing is being recorded. Durations need a fine clock, see SABERTOOTH_CLOCK_MICROS.
+*/
+class USBSabertoothTrace
+{
+public:
+  static void record(USBSabertoothTraceKind kind, const void* object, uint32_t start, int a, int b);
+  static void clear();
+  static void writeJSON(Print& out);
   
-  inline boolean async_getTemperature(byte motorOutputNumber, int context=0, boolean unscaled=false ) {
-    return async_get('M', motorOutputNumber, SABERTOOTH_GET_TEMPERATURE, context, unscaled);
-  }
+private:
+  static USBSabertoothTraceEvent _events[SABERTOOTH_TRACE_LENGTH];
+  static uint32_t                _next;
+};
+
+#define SABERTOOTH_TRACE_START(start)             uint32_t start = USBSabertoothTimeout::now()
+#define SABERTOOTH_TRACE_MARK(kind, a, b)         USBSabertoothTrace::record(kind, this, USBSabertoothTimeout::now(), a, b)
+#define SABERTOOTH_TRACE_SPAN(kind, start, a, b)  USBSabertoothTrace::record(kind, this, start, a, b)
+#else
+#define SABERTOOTH_TRACE_START(start)             do {} while (0)
+#define SABERTOOTH_TRACE_MARK(kind, a, b)         do {} while (0)
+#define SABERTOOTH_TRACE_SPAN(kind, start, a, b)  do {} while (0)
+#endif
+
+/*!
+\enum USBSabertoothTaskState
+Where a USBSabertoothTask stands with its awaited get.
+*/
+enum USBSabertoothTaskState
+{
+  SABERTOOTH_TASK_READY     = 0, /*!< Not awaiting anything. */
+  SABERTOOTH_TASK_WAITING   = 1, /*!< The get was accepted and its reply is outstanding. */
+  SABERTOOTH_TASK_COMPLETED = 2  /*!< The reply arrived, result holds it. */
+};
+
+/*!
+Task body macros, see USBSabertoothTask. Use at most one of them per source line.
+*/
+#if defined(__has_attribute)
+#if __has_attribute(fallthrough)
+#define SABERTOOTH_FALLTHROUGH      __attribute__((fallthrough))   // resuming labels are entered from above too
+#endif
+#endif
+#ifndef SABERTOOTH_FALLTHROUGH
+#define SABERTOOTH_FALLTHROUGH      do {} while (0)
+#endif
+
+#define SABERTOOTH_TASK_BEGIN()     switch (_line) { case 0:
+#define SABERTOOTH_TASK_END()       } _line = -1; return;
+#define SABERTOOTH_YIELD()          do { _line = __LINE__; return; case __LINE__:; } while (0)
+#define SABERTOOTH_SLEEP(ms)        do { _wake = USBSabertoothTimeout::now() + (uint32_t)(ms) * SABERTOOTH_TICKS_PER_MS; \
+                                         _line = __LINE__; SABERTOOTH_FALLTHROUGH; case __LINE__: \
+                                         if ((int32_t)(USBSabertoothTimeout::now() - _wake) < 0) { return; } } while (0)
+#define SABERTOOTH_AWAIT(start)     do { _line = __LINE__; SABERTOOTH_FALLTHROUGH; case __LINE__: \
+                                         if (_state == SABERTOOTH_TASK_READY) { if (_canStart && (start)) { _state = SABERTOOTH_TASK_WAITING; } return; } \
+                                         if (_state == SABERTOOTH_TASK_WAITING) { return; } \
+                                         _state = SABERTOOTH_TASK_READY; } while (0)
+
+/*!
+\class USBSabertoothTask
+\brief Sequential code over the asynchronous get functions.
+
+Derive from it and write run() between SABERTOOTH_TASK_BEGIN() and SABERTOOTH_TASK_END():
+\code
+  class Watch : public USBSabertoothTask
+  {
+    void run()
+    {
+      SABERTOOTH_TASK_BEGIN();
+      for (;;)
+      {
+        SABERTOOTH_AWAIT(ST.async_getCurrent(1));
+        current = result;
+        SABERTOOTH_SLEEP(100);
+      }
+      SABERTOOTH_TASK_END();
+    }
+    int current;
+  };
+\endcode
+SABERTOOTH_AWAIT retries its async_get until no other task awaits and the driver accepts it, then suspends the task until
+the reply (or SABERTOOTH_GET_ERROR / SABERTOOTH_GET_TIMED_OUT) is in result.
+run() returns at every suspension and resumes at the same line, so its local variables do not
+survive a suspension: keep state in members. Tasks live wherever you declare them, nothing is
+allocated. A USBSabertoothScheduler resumes them.
+*/
+class USBSabertoothTask
+{
+  friend class USBSabertoothScheduler;
   
 public:
-  /*! Gets the get retry interval.
-  \return The get retry interval, in milliseconds.
+  /*!
+  Constructs a USBSabertoothTask, ready to start.
   */
-  //inline int32_t getGetRetryInterval() const { return _getRetryInterval; }
+  USBSabertoothTask();
   
+public:
   /*!
-  Sets the get retry interval.
-  \param intervalMS The command retry interval, in milliseconds.
+  Gets whether the task reached SABERTOOTH_TASK_END().
+  \return true if the task is done.
   */
-  //inline void setGetRetryInterval(int32_t intervalMS) { _getRetryInterval = intervalMS; }
-
+  inline boolean done() const { return _line < 0; }
+  
   /*!
-  Gets the get timeout. DEPRECATED, use the USBSabertoothSerial functions instead
-  \return The get timeout, in milliseconds.
+  Starts the task again from SABERTOOTH_TASK_BEGIN().
+  Do not restart a task that is awaiting a get.
   */
-  inline int32_t getGetTimeout() const { return _serial._request.timeoutMS(); }
+  inline void restart() { _line = 0; _state = SABERTOOTH_TASK_READY; }
   
+protected:
   /*!
-  Sets the get timeout. DEPRECATED, use the USBSabertoothSerial functions instead
-  \param timeoutMS The get timeout, in milliseconds.
+  The task body. Called by the scheduler every time the task can make progress.
   */
-  inline void setGetTimeout(int32_t timeoutMS) { _serial._request.setTimeoutMS(timeoutMS); }
+  virtual void run() = 0;
+  
+protected:
+  int                       result;
+  int                       _line;
+  uint32_t                  _wake;
+  USBSabertoothTaskState    _state;
+  boolean                   _canStart;
+};
+
+/*!
+\class USBSabertoothScheduler
+\brief Resumes USBSabertoothTask's sharing one USBSabertoothSerial.
 
+Call run() from loop(). Only one get is in flight on a serial at a time, so while one task
+awaits, the others wanting a get retry at later run() calls, in the order they were added.
+*/
+class USBSabertoothScheduler
+{
+public:
   /*!
-  Gets whether CRC-protected commands are used. They are, by default.
-  \return True if CRC-protected commands are used.
-  */  
-  inline boolean usingCRC() const { return  _crc; }
+  Constructs a USBSabertoothScheduler.
+  \param serial The USBSabertoothSerial the tasks' drivers use.
+  */
+  USBSabertoothScheduler(USBSabertoothSerial& serial);
   
+public:
   /*!
-  Causes future commands to be sent CRC-protected (larger packets, excellent error detection).
+  Adds a task.
+  \param task The task. It must outlive the scheduler.
+  \return true if added, false if SABERTOOTH_MAX_TASKS tasks are already there.
   */
-  inline void useChecksum() { _crc = false; }
+  boolean add(USBSabertoothTask& task);
   
   /*!
-  Causes future commands to be sent checksum-protected (smaller packets, reasonable error detection).
+  Delivers the outstanding reply, if any, and resumes every task that is not awaiting one.
+  Always returns immediatelly.
   */
-  inline void useCRC() { _crc = true ; }
+  void run();
   
 private:
-  int get(byte type, byte number,
-          USBSabertoothGetType getType, boolean unscaled);
-  
-  boolean async_get(byte type, byte number,
-          USBSabertoothGetType getType, int context, boolean unscaled);
-          
-  void set(byte type, byte number, int value,
-            USBSabertoothSetType setType);
+  void resume(USBSabertoothTask* task);
   
 private:
-  const byte           _address;
-  boolean              _crc;
-  USBSabertoothSerial& _serial;
+  USBSabertoothSerial&      _serial;
+  USBSabertoothTask*        _tasks[SABERTOOTH_MAX_TASKS];
+  USBSabertoothTask*        _owner;
+  byte                      _count;
 };
 
 #endif
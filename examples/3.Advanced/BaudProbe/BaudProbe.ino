@@ -0,0 +1,45 @@
+// Baud Probe Sample for USB Sabertooth Packet Serial
+// Finds the fastest baud rate that works reliably, here on a USBSabertoothEmulator
+// whose cable is clean up to 57600 baud and picks up errors above it, on virtual time.
+// Prints one CSV line per rate, baud,sent,replies,rejects,timeouts,ok, then the chosen rate.
+// On real hardware, drop the emulator and the virtual clock, construct C on the port the
+// driver is on, and make setBaud switch both the port and the driver.
+
+#include <USBSabertooth_NB.h>
+
+const uint32_t RATES[] = { 9600, 19200, 38400, 57600, 115200 };
+
+uint32_t virtualTicks = 0;
+uint32_t virtualClock() { return virtualTicks; }
+
+USBSabertoothEmulator  line;
+USBSabertoothSerial    C(line);
+USBSabertooth          ST(C, 128);
+
+void setBaud(uint32_t baud, void*)
+{
+  line.setBaud(baud);
+}
+
+USBSabertoothBaudProbe probe(C, ST, setBaud);
+
+void setup()
+{
+  Serial.begin(115200);
+  
+  USBSabertoothTimeout::setClock(virtualClock);
+  line.setNoise(57600, 20);   // 2% of the bytes corrupted at 115200
+  
+  probe.begin(RATES, sizeof(RATES) / sizeof(RATES[0]), 200, 99, line.baud());
+  while (!probe.run()) { virtualTicks ++; }
+  
+  Serial.println("baud,sent,replies,rejects,timeouts,ok");
+  probe.printCSV(Serial);
+  Serial.print("Fastest reliable rate: "); Serial.println(probe.best());
+  
+  USBSabertoothTimeout::setClock(NULL);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,120 @@
+// Bounded Work Sample for USB Sabertooth Packet Serial
+// Measures the worst time a single reply_available call takes while the port is flooded
+// with garbage, for USBSabertoothSerial and USBSabertoothArbiter, with and without setBudget.
+// Without a budget one call reads the whole burst, so its time grows with the burst. With a
+// budget of B bytes a call reads at most B bytes, so its worst time is B times the cost of
+// one byte plus a constant, whatever arrives; the remaining bytes are read by later calls.
+// One CSV line is printed per run:
+//   path,budget_bytes,burst_bytes,calls,worst_us,mean_us
+// On a host, interrupts and preemption show up as occasional outliers in worst_us.
+// With no driver needed, nothing has to be connected.
+
+#include <USBSabertooth_NB.h>
+
+const uint16_t BURSTS[]  = { 64, 256, 1024 };
+const uint16_t BUDGETS[] = { 0, 8, 32 };   // 0 is no budget
+const byte     ROUNDS    = 20;
+
+// a port that returns a burst of random bytes, as a noisy line or a misconfigured device would
+class Flood : public Stream
+{
+public:
+  Flood() : left(0) {}
+  
+  void refill(uint16_t bytes) { left = bytes; }
+  
+  int    available()             { return left; }
+  int    read     ()             { if (!left) { return -1; } left --; return random(256); }
+  int    peek     ()             { return left ? 0 : -1; }
+  void   flush    ()             { }
+  size_t write    (uint8_t)      { return 1; }
+  using Print::write;
+  
+  uint16_t left;
+};
+
+Flood port;
+
+void report(const char* path, uint16_t budget, uint16_t burst, uint32_t calls, uint32_t worst, uint32_t total)
+{
+  Serial.print(path);   Serial.print(',');
+  Serial.print(budget); Serial.print(',');
+  Serial.print(burst);  Serial.print(',');
+  Serial.print(calls);  Serial.print(',');
+  Serial.print(worst);  Serial.print(',');
+  Serial.println(calls ? total / calls : 0);
+}
+
+void runSerial(uint16_t budget, uint16_t burst)
+{
+  USBSabertoothSerial C(port);
+  USBSabertooth       ST(C, 128);
+  C.setPollInterval(SABERTOOTH_INFINITE_TIMEOUT);
+  C.setGetTimeout(SABERTOOTH_INFINITE_TIMEOUT);   // the get stays in flight through the flood
+  C.setBudget(budget);
+  
+  uint32_t calls = 0, worst = 0, total = 0;
+  for (byte round = 0; round < ROUNDS; round ++)
+  {
+    ST.async_getBattery(1);
+    port.refill(burst);
+    while (port.available())
+    {
+      int result, context;
+      uint32_t start = micros();
+      C.reply_available(&result, &context);
+      uint32_t spent = micros() - start;
+  
+      calls ++; total += spent;
+      if (spent > worst) { worst = spent; }
+    }
+  }
+  report("serial", budget, burst, calls, worst, total);
+}
+
+void runArbiter(uint16_t budget, uint16_t burst)
+{
+  USBSabertoothSerial  C(port);
+  USBSabertooth        ST(C, 128);
+  USBSabertoothArbiter A(C, 9600);
+  C.setGetTimeout(SABERTOOTH_INFINITE_TIMEOUT);
+  C.setBudget(budget);
+  
+  uint32_t calls = 0, worst = 0, total = 0;
+  for (byte round = 0; round < ROUNDS; round ++)
+  {
+    A.async_get(ST, 'M', 1, SABERTOOTH_GET_BATTERY);
+    port.refill(burst);
+    while (port.available())
+    {
+      int result, context;
+      uint32_t start = micros();
+      A.reply_available(&result, &context);
+      uint32_t spent = micros() - start;
+  
+      calls ++; total += spent;
+      if (spent > worst) { worst = spent; }
+    }
+  }
+  report("arbiter", budget, burst, calls, worst, total);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  randomSeed(1);
+  
+  Serial.println("path,budget_bytes,burst_bytes,calls,worst_us,mean_us");
+  for (byte i = 0; i < sizeof(BURSTS) / sizeof(BURSTS[0]); i ++)
+  {
+    for (byte j = 0; j < sizeof(BUDGETS) / sizeof(BUDGETS[0]); j ++)
+    {
+      runSerial (BUDGETS[j], BURSTS[i]);
+      runArbiter(BUDGETS[j], BURSTS[i]);
+    }
+  }
+}
+
+void loop()
+{
+}
@@ -0,0 +1,92 @@
+// Current Limit Sample for USB Sabertooth Packet Serial
+// Runs a USBSabertoothCurrentLimiter against the USBSabertoothEmulator on virtual time,
+// at 9600, 38400 and 115200 baud, so no hardware is needed.
+// Motor 1 runs at nearly full power under a light load, then the load steps up so
+// that the current would be more than twice the limit. One CSV line is printed per run:
+//   baud,loop_hz,reaction_ms,settled_current,limit,power
+// loop_hz is the rate of current readings processed by the PI loop, reaction_ms the time
+// from the load step until the emulated current is back within 10% of the limit.
+// For the same loop on a real driver, replace the emulator by the serial port.
+
+#include <USBSabertooth_NB.h>
+
+const uint32_t BAUDS[]  = { 9600, 38400, 115200 };
+const int      LIMIT    = 80;
+const uint32_t SECONDS  = 4;
+const uint32_t STEP     = SABERTOOTH_TICKS_PER_MS > 1 ? 50 : 1;   // loop period, in ticks
+
+uint32_t virtualTicks = 0;
+uint32_t virtualClock() { return virtualTicks; }
+
+USBSabertoothEmulator       line;
+USBSabertoothSerial         C(line);
+USBSabertooth               ST(C, 128);
+USBSabertoothCurrentLimiter limiter(C, ST);
+
+int emulatedCurrent(int fullCurrent)
+{
+  return (int)((int32_t)abs(line.value(128, 'M', 1)) * fullCurrent / 2047);
+}
+
+void run(uint32_t baud)
+{
+  line.setBaud(baud);
+  line.reset();
+  line.setReadings(240, 25, 60);   // light load: 60 at full power
+  
+  limiter.setLimit(1, LIMIT);
+  limiter.motor(1, 2000);
+  
+  uint32_t start = virtualTicks, step = start + SECONDS * 500UL * SABERTOOTH_TICKS_PER_MS;
+  uint32_t end = start + SECONDS * 1000UL * SABERTOOTH_TICKS_PER_MS;
+  uint32_t updates = limiter.updates(), reaction = 0;
+  boolean stepped = false, reacted = false;
+  
+  while ((int32_t)(end - virtualTicks) > 0)
+  {
+    if (!stepped && (int32_t)(virtualTicks - step) >= 0)
+    {
+      line.setReadings(240, 25, 200);   // heavy load: 200 at full power
+      stepped = true;
+    }
+    
+    limiter.run();
+    
+    if (stepped && !reacted && emulatedCurrent(200) <= LIMIT + LIMIT / 10)
+    {
+      reaction = virtualTicks - step;
+      reacted = true;
+    }
+    
+    virtualTicks += STEP;
+  }
+  
+  Serial.print(baud); Serial.print(',');
+  Serial.print((limiter.updates() - updates) / SECONDS); Serial.print(',');
+  if (reacted) { Serial.print((float)reaction / SABERTOOTH_TICKS_PER_MS); } else { Serial.print("none"); }
+  Serial.print(',');
+  Serial.print(limiter.current(1)); Serial.print(',');
+  Serial.print(LIMIT); Serial.print(',');
+  Serial.println(line.value(128, 'M', 1));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  
+  USBSabertoothTimeout::setClock(virtualClock);
+  C.setPollInterval(0);   // send every get as soon as the previous reply is in
+  C.setGetTimeout(200);
+  
+  Serial.println("baud,loop_hz,reaction_ms,settled_current,limit,power");
+  for (byte b = 0; b < sizeof(BAUDS) / sizeof(BAUDS[0]); b ++)
+  {
+    run(BAUDS[b]);
+  }
+  
+  USBSabertoothTimeout::setClock(NULL);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,131 @@
+// Event Loop Sample for USB Sabertooth Packet Serial
+// Drives many lines from one loop without busy polling, the way a host would with epoll and
+// timerfd. Each pass sleeps until the earliest ticksUntilDue() of all lines, and then calls
+// reply_available only on lines that are due or have bytes waiting. The lines here are
+// USBSabertoothEmulator's on virtual time, so bytes arriving can not wake the loop as a file
+// descriptor would; while a line is awaitingReply() the sleep is capped at STEP instead.
+// Every line runs current gets back to back. One CSV line is printed per number of lines:
+//   lines,seconds,gets,gets_per_s,timeouts,wakeups_per_s,calls_per_get,busy_calls_per_get,p50,p99,max
+// calls_per_get counts reply_available calls made by the loop, busy_calls_per_get those a loop
+// calling every line every STEP would have made. Latencies are in clock ticks, milliseconds
+// unless the library is built with SABERTOOTH_CLOCK_MICROS=1; a get at 115200 baud takes about
+// two milliseconds, so only the finer clock shows the difference between the two loops.
+// 64 emulated lines need a few tens of kilobytes of RAM; lower LINES on small boards.
+
+#include <USBSabertooth_NB.h>
+
+const byte     LINES[]  = { 1, 4, 16, 64 };
+const uint32_t BAUD     = 115200;
+const uint32_t SECONDS  = 10;
+const uint32_t STEP     = SABERTOOTH_TICKS_PER_MS > 1 ? 20 : 1;   // sleep cap while awaiting bytes, in ticks
+const byte     BINS     = 200;
+const uint32_t BIN      = SABERTOOTH_TICKS_PER_MS > 1 ? 50 : 1;   // histogram resolution, in ticks
+
+uint32_t virtualTicks = 0;
+uint32_t virtualClock() { return virtualTicks; }
+
+struct Line
+{
+  Line() : C(port), ST(C, 128), issued(0) {}
+  
+  USBSabertoothEmulator port;
+  USBSabertoothSerial   C;
+  USBSabertooth         ST;
+  uint32_t              issued;
+};
+
+uint32_t histogram[BINS + 1];
+
+uint32_t percentile(uint32_t count, byte percent)
+{
+  uint32_t wanted = (count * percent + 99) / 100, seen = 0;
+  for (int i = 0; i <= BINS; i ++)
+  {
+    seen += histogram[i];
+    if (seen >= wanted) { return i * BIN; }
+  }
+  return BINS * BIN;
+}
+
+void run(byte count)
+{
+  Line* lines = new Line[count];
+  for (byte i = 0; i < count; i ++)
+  {
+    lines[i].port.setBaud(BAUD);
+    lines[i].C.setPollInterval(0);   // send every get as soon as reply_available is called
+    lines[i].C.setGetTimeout(200);
+    lines[i].ST.async_getCurrent(1);
+    lines[i].issued = virtualTicks;
+  }
+  memset(histogram, 0, sizeof(histogram));
+  
+  uint32_t start = virtualTicks, end = start + SECONDS * 1000UL * SABERTOOTH_TICKS_PER_MS;
+  uint32_t gets = 0, timeouts = 0, worst = 0, wakeups = 0, calls = 0;
+  
+  while ((int32_t)(end - virtualTicks) > 0)
+  {
+    // the epoll_wait timeout
+    int32_t sleep = SABERTOOTH_INFINITE_TIMEOUT;
+    for (byte i = 0; i < count; i ++)
+    {
+      int32_t due = lines[i].C.ticksUntilDue();
+      if (lines[i].C.awaitingReply() && (due < 0 || due > (int32_t)STEP)) { due = STEP; }
+      if (due >= 0 && (sleep < 0 || due < sleep)) { sleep = due; }
+    }
+    virtualTicks += sleep < 0 ? STEP : sleep;
+    wakeups ++;
+  
+    // the ready file descriptors and expired timers
+    for (byte i = 0; i < count; i ++)
+    {
+      Line& line = lines[i];
+      if (line.C.ticksUntilDue() != 0 && !line.port.available()) { continue; }
+  
+      int result, context;
+      calls ++;
+      if (!line.C.reply_available(&result, &context)) { continue; }
+  
+      if (result == SABERTOOTH_GET_TIMED_OUT || result == SABERTOOTH_GET_ERROR) { timeouts ++; }
+      else
+      {
+        uint32_t latency = virtualTicks - line.issued;
+        if (latency > worst) { worst = latency; }
+        histogram[latency / BIN < BINS ? latency / BIN : BINS] ++;
+        gets ++;
+      }
+      line.ST.async_getCurrent(1);
+      line.issued = virtualTicks;
+    }
+  }
+  delete[] lines;
+  
+  uint32_t busyCalls = (virtualTicks - start) / STEP * count;
+  Serial.print(count);                              Serial.print(',');
+  Serial.print(SECONDS);                            Serial.print(',');
+  Serial.print(gets);                               Serial.print(',');
+  Serial.print(gets / SECONDS);                     Serial.print(',');
+  Serial.print(timeouts);                           Serial.print(',');
+  Serial.print(wakeups / SECONDS);                  Serial.print(',');
+  Serial.print(gets ? (float)calls / gets : 0);     Serial.print(',');
+  Serial.print(gets ? (float)busyCalls / gets : 0); Serial.print(',');
+  Serial.print(percentile(gets, 50));               Serial.print(',');
+  Serial.print(percentile(gets, 99));               Serial.print(',');
+  Serial.println(worst);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  
+  USBSabertoothTimeout::setClock(virtualClock);
+  
+  Serial.println("lines,seconds,gets,gets_per_s,timeouts,wakeups_per_s,calls_per_get,busy_calls_per_get,p50,p99,max");
+  for (byte i = 0; i < sizeof(LINES) / sizeof(LINES[0]); i ++) { run(LINES[i]); }
+  
+  USBSabertoothTimeout::setClock(NULL);
+}
+
+void loop()
+{
+}
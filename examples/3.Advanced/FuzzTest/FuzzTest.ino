@@ -0,0 +1,151 @@
+// Fuzz Test Sample for USB Sabertooth Packet Serial
+// Checks properties of the reply framer with random input, complementing the golden packets
+// of the SelfTest example:
+//  - roundtrip: a valid reply after random garbage is always received, and kept intact until taken
+//  - truncated: a reply cut short at any point never hides the complete reply that follows it
+//  - random:    every frame accepted from a random byte stream is a valid packet
+//  - mutated:   a reply with one bit flipped is rejected, or still decodes as a valid packet
+// The seed is printed so a failure can be repeated. With no driver needed, nothing has to be
+// connected. Increase ROUNDS for a longer run.
+
+#include <USBSabertooth_NB.h>
+
+const unsigned long ROUNDS = 20000;
+
+unsigned long passed, failed, randomFrames, mutationsAccepted;
+
+byte randomReply(byte* buffer, byte* data)
+{
+  boolean crc = SABERTOOTH_USE_CRC(random(2) != 0);
+  for (byte i = 0; i < 5; i ++) { data[i] = random(128); }
+  return USBSabertoothCommandWriter::writeToBuffer(buffer, 128 + random(8), (USBSabertoothCommand)SABERTOOTH_RC_GET, crc, data, 5);
+}
+
+boolean receivedIntact(const USBSabertoothReplyReceiver& receiver, const byte* buffer, const byte* data)
+{
+  return receiver.ready() && receiver.address() == (buffer[0] & ~0x70) &&
+         receiver.data()[2] == data[0] && !memcmp(receiver.data() + 4, data + 1, 4);
+}
+
+boolean validFrame(const USBSabertoothReplyReceiver& receiver)
+{
+  byte raw[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+  byte length = receiver.usingCRC() ? 10 : 9;
+  memcpy(raw, receiver.data(), length);
+  if (receiver.usingCRC()) { raw[0] |= 0x70; }   // the receiver strips the CRC flag from the address
+  
+  USBSabertoothPacket packet;
+  USBSabertoothPacketDecoder::parse(raw, length, &packet);
+  return packet.valid;
+}
+
+void report(const char* name, unsigned long failures)
+{
+  Serial.print(name); Serial.print(": ");
+  Serial.println(failures ? "FAIL" : "ok");
+  if (failures) { failed ++; } else { passed ++; }
+}
+
+void testRoundtrip()
+{
+  unsigned long failures = 0;
+  for (unsigned long round = 0; round < ROUNDS; round ++)
+  {
+    USBSabertoothReplyReceiver receiver;
+    byte buffer[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH], data[5];
+    byte length = randomReply(buffer, data);
+  
+    // garbage may frame by chance; that is the random property, here it is just taken away
+    for (byte garbage = random(24); garbage; garbage --)
+    {
+      receiver.read(random(256));
+      if (receiver.ready()) { receiver.reset(); }
+    }
+    for (byte i = 0; i < length; i ++) { receiver.read(buffer[i]); }
+    receiver.read(0x80 | random(128));   // the next packet starting must not lose it
+    if (!receivedIntact(receiver, buffer, data)) { failures ++; }
+  }
+  report("roundtrip", failures);
+}
+
+void testTruncated()
+{
+  unsigned long failures = 0;
+  for (unsigned long round = 0; round < ROUNDS; round ++)
+  {
+    USBSabertoothReplyReceiver receiver;
+    byte cut[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH], cutData[5];
+    byte buffer[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH], data[5];
+    byte cutLength = random(1, randomReply(cut, cutData));
+    byte length = randomReply(buffer, data);
+  
+    for (byte i = 0; i < cutLength; i ++) { receiver.read(cut[i]); }
+    if (receiver.ready()) { failures ++; continue; }
+    for (byte i = 0; i < length; i ++) { receiver.read(buffer[i]); }
+    if (!receivedIntact(receiver, buffer, data)) { failures ++; }
+  }
+  report("truncated", failures);
+}
+
+void testRandom()
+{
+  unsigned long failures = 0;
+  USBSabertoothReplyReceiver receiver;
+  for (unsigned long i = 0; i < ROUNDS * 20; i ++)
+  {
+    byte value = random(128);
+    if (!random(4)) { value |= 0x80; }   // headers often enough to start many frames
+    receiver.read(value);
+    if (receiver.ready())
+    {
+      randomFrames ++;
+      if (!validFrame(receiver)) { failures ++; }
+      receiver.reset();
+    }
+  }
+  report("random", failures);
+}
+
+void testMutated()
+{
+  unsigned long failures = 0;
+  for (unsigned long round = 0; round < ROUNDS; round ++)
+  {
+    USBSabertoothReplyReceiver receiver;
+    byte buffer[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH], data[5];
+    byte length = randomReply(buffer, data);
+    buffer[random(length)] ^= 1 << random(7);
+  
+    for (byte i = 0; i < length; i ++) { receiver.read(buffer[i]); }
+    if (receiver.ready())
+    {
+      mutationsAccepted ++;
+      if (!validFrame(receiver)) { failures ++; }
+    }
+  }
+  report("mutated", failures);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  
+  unsigned long seed = micros();
+  randomSeed(seed);
+  Serial.print("seed: "); Serial.println(seed);
+  
+  testRoundtrip();
+  testTruncated();
+  testRandom();
+  testMutated();
+  
+  Serial.print("random frames accepted: ");   Serial.println(randomFrames);
+  Serial.print("mutated replies accepted: "); Serial.print(mutationsAccepted);
+  Serial.print(" of ");                       Serial.println(ROUNDS);
+  Serial.print("fuzz: "); Serial.print(passed); Serial.print(" passed, ");
+  Serial.print(failed);   Serial.println(" failed");
+}
+
+void loop()
+{
+}
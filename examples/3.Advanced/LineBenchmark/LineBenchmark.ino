@@ -0,0 +1,124 @@
+// Line Benchmark Sample for USB Sabertooth Packet Serial
+// Measures how much traffic a shared line sustains at 9600, 38400 and 115200 baud,
+// with CRC and with checksum, using the USBSabertoothEmulator on virtual time,
+// so no hardware is needed and every run takes a fraction of a second.
+// DRIVERS drivers share the line; each gets SET_RATE_HZ motor sets per second,
+// while current gets run back to back in turns. One CSV line is printed per run:
+//   baud,crc,drivers,set_rate_hz,seconds,sets,gets,gets_per_s,timeouts,errors,p50,p99,max,tx_util_pct,rx_util_pct
+// Latencies are in clock ticks, milliseconds unless the library is built with
+// SABERTOOTH_CLOCK_MICROS=1, which gives finer results.
+
+#include <USBSabertooth_NB.h>
+
+const uint32_t BAUDS[]      = { 9600, 38400, 115200 };
+const byte     DRIVERS      = 4;    // 1 to 8
+const int      SET_RATE_HZ  = 20;
+const uint32_t SECONDS      = 10;
+const uint32_t STEP         = SABERTOOTH_TICKS_PER_MS > 1 ? 20 : 1;   // loop period, in ticks
+const byte     BINS         = 200;
+const uint32_t BIN          = SABERTOOTH_TICKS_PER_MS > 1 ? 500 : 1;  // histogram resolution, in ticks
+
+uint32_t virtualTicks = 0;
+uint32_t virtualClock() { return virtualTicks; }
+
+USBSabertoothEmulator line;
+USBSabertoothSerial   C(line);
+USBSabertooth         ST[8] = { USBSabertooth(C, 128), USBSabertooth(C, 129), USBSabertooth(C, 130), USBSabertooth(C, 131),
+                                USBSabertooth(C, 132), USBSabertooth(C, 133), USBSabertooth(C, 134), USBSabertooth(C, 135) };
+
+uint16_t histogram[BINS + 1];
+
+uint32_t percentile(uint32_t count, byte percent)
+{
+  uint32_t wanted = (count * percent + 99) / 100, seen = 0;
+  for (int i = 0; i <= BINS; i ++)
+  {
+    seen += histogram[i];
+    if (seen >= wanted) { return i * BIN; }
+  }
+  return BINS * BIN;
+}
+
+void run(uint32_t baud, boolean crc)
+{
+  line.setBaud(baud);
+  line.reset();
+  for (byte d = 0; d < DRIVERS; d ++) { if (crc) { ST[d].useCRC(); } else { ST[d].useChecksum(); } }
+  memset(histogram, 0, sizeof(histogram));
+  
+  uint32_t start = virtualTicks, end = start + SECONDS * 1000UL * SABERTOOTH_TICKS_PER_MS;
+  uint32_t setPeriod = 1000UL * SABERTOOTH_TICKS_PER_MS / SET_RATE_HZ, nextSet = start;
+  uint32_t sets = 0, gets = 0, timeouts = 0, errors = 0, worst = 0, issued = 0;
+  byte next = 0; boolean waiting = false;
+  
+  while ((int32_t)(end - virtualTicks) > 0)
+  {
+    if ((int32_t)(virtualTicks - nextSet) >= 0)
+    {
+      for (byte d = 0; d < DRIVERS; d ++) { ST[d].motor(1, (int)(virtualTicks % 4095) - 2047); }
+      sets += DRIVERS; nextSet += setPeriod;
+    }
+    
+    if (!waiting && ST[next].async_getCurrent(1, next))
+    {
+      waiting = true; issued = virtualTicks;
+      next = (next + 1) % DRIVERS;
+    }
+    
+    int result, context;
+    if (C.reply_available(&result, &context))
+    {
+      waiting = false;
+      if      (result == SABERTOOTH_GET_TIMED_OUT) { timeouts ++; }
+      else if (result == SABERTOOTH_GET_ERROR    ) { errors   ++; }
+      else
+      {
+        uint32_t latency = virtualTicks - issued;
+        if (latency > worst) { worst = latency; }
+        histogram[latency / BIN < BINS ? latency / BIN : BINS] ++;
+        gets ++;
+      }
+    }
+    
+    virtualTicks += STEP;
+  }
+  
+  uint32_t elapsedMicros = (virtualTicks - start) * (1000 / SABERTOOTH_TICKS_PER_MS);
+  Serial.print(baud);                  Serial.print(',');
+  Serial.print(crc ? "crc" : "checksum"); Serial.print(',');
+  Serial.print(DRIVERS);               Serial.print(',');
+  Serial.print(SET_RATE_HZ);           Serial.print(',');
+  Serial.print(SECONDS);               Serial.print(',');
+  Serial.print(sets);                  Serial.print(',');
+  Serial.print(gets);                  Serial.print(',');
+  Serial.print(gets / SECONDS);        Serial.print(',');
+  Serial.print(timeouts);              Serial.print(',');
+  Serial.print(errors);                Serial.print(',');
+  Serial.print(percentile(gets, 50));  Serial.print(',');
+  Serial.print(percentile(gets, 99));  Serial.print(',');
+  Serial.print(worst);                 Serial.print(',');
+  Serial.print(line.txBusyMicros() / (elapsedMicros / 100)); Serial.print(',');
+  Serial.println(line.rxBusyMicros() / (elapsedMicros / 100));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  
+  USBSabertoothTimeout::setClock(virtualClock);
+  C.setPollInterval(0);   // send every get as soon as it is accepted
+  C.setGetTimeout(200);
+  
+  Serial.println("baud,crc,drivers,set_rate_hz,seconds,sets,gets,gets_per_s,timeouts,errors,p50,p99,max,tx_util_pct,rx_util_pct");
+  for (byte b = 0; b < sizeof(BAUDS) / sizeof(BAUDS[0]); b ++)
+  {
+    run(BAUDS[b], true);
+    run(BAUDS[b], false);
+  }
+  
+  USBSabertoothTimeout::setClock(NULL);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,48 @@
+// Memory Report Sample for USB Sabertooth Packet Serial
+// Prints the RAM taken by each library object for the current build configuration.
+// Flash use is the program size reported by the IDE when compiling this sketch.
+//
+// To compare configurations, add the following to the compiler flags
+// (for example with a platform.local.txt) and rebuild:
+//   -DSABERTOOTH_COMPACT=1        packed flags and 16 bit timestamps
+//   -DSABERTOOTH_NO_SYNC_GET=1    no blocking get functions
+//   -DSABERTOOTH_CRC_ONLY=1       no checksum path, or
+//   -DSABERTOOTH_CHECKSUM_ONLY=1  no CRC path
+
+#include <USBSabertooth_NB.h>
+
+USBSabertoothSerial C;
+USBSabertooth       ST(C, 128);
+
+void report(const char* name, size_t size)
+{
+  Serial.print(name); Serial.print(','); Serial.println((unsigned)size);
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  SabertoothTXPinSerial.begin(9600);
+  
+  Serial.print("compact,"      ); Serial.println(SABERTOOTH_COMPACT);
+  Serial.print("no_sync_get,"  ); Serial.println(SABERTOOTH_NO_SYNC_GET);
+  Serial.print("crc_only,"     ); Serial.println(SABERTOOTH_CRC_ONLY);
+  Serial.print("checksum_only,"); Serial.println(SABERTOOTH_CHECKSUM_ONLY);
+  
+  report("USBSabertoothSerial",        sizeof(USBSabertoothSerial));
+  report("USBSabertooth",              sizeof(USBSabertooth));
+  report("USBSabertoothReplyReceiver", sizeof(USBSabertoothReplyReceiver));
+  report("USBSabertoothRequest",       sizeof(USBSabertoothRequest));
+  report("USBSabertoothTimeout",       sizeof(USBSabertoothTimeout));
+  report("USBSabertoothQueue",         sizeof(USBSabertoothQueue));
+  
+  // keep the communication code in the build so the flash figure is meaningful
+  ST.motor(1, 0);
+  ST.async_getBattery(1);
+}
+
+void loop()
+{
+  int result, context;
+  C.reply_available(&result, &context);
+}
@@ -0,0 +1,103 @@
+// Queued I/O Sample for USB Sabertooth Packet Serial
+// The control step only talks to a USBSabertoothQueue, and the serial I/O is done by
+// USBSabertoothQueue::service(). On an ESP32 service() runs on its own FreeRTOS task, so
+// the serial port is never touched by the control loop; elsewhere it runs from yield().
+// Set QUEUED to 0 to compare against direct calls. Every second the worst time spent in the
+// control step (the set and get handling, not the whole loop) is printed, together with the
+// number of sets the queue refused because its ring was full.
+// This example assumes a board with Serial and Serial1 interfaces (only required for display purposes)
+
+#include <USBSabertooth_NB.h>
+
+#define QUEUED 1
+
+USBSabertoothSerial C;
+USBSabertooth       ST(C, 128);
+USBSabertoothQueue  Q(C);
+
+int battery = 0;
+int current1 = 0;
+unsigned long dropped = 0;
+
+#if QUEUED
+#if defined(ESP32)
+void ioTask(void*)
+{
+  for (;;)
+  {
+    Q.service();   // the I/O side, the only code touching C and its port
+    vTaskDelay(1);
+  }
+}
+#else
+void yield()
+{
+  Q.service();   // the I/O side, runs whenever the sketch idles
+}
+#endif
+#endif
+
+void setup()
+{
+  Serial.begin(9600);
+  SabertoothTXPinSerial.begin(9600);
+
+#if QUEUED && defined(ESP32)
+  xTaskCreatePinnedToCore(ioTask, "sabertooth", 2048, NULL, 1, NULL, 0);
+#endif
+}
+
+void loop()
+{
+  static unsigned long command = 0, worst = 0, report = 0;
+  if (millis() - command < 20) { yield(); return; }
+  command = millis();
+  int value = (int)((millis() / 10) % 4095) - 2047;
+
+  unsigned long start = micros();
+
+#if QUEUED
+  if (!Q.submitSet(ST, 'M', 1, value)) { dropped++; }
+
+  // one get at a time, the next one is queued when the previous one completed
+  static boolean waiting = false, toggle = false;
+  USBSabertoothOperation done;
+  while (Q.completion(&done))
+  {
+    if (done.context == 0) { battery  = done.value; }
+    if (done.context == 1) { current1 = done.value; }
+    waiting = false;
+  }
+  if (!waiting)
+  {
+    toggle = !toggle;
+    waiting = toggle ? Q.submitGet(ST, 'M', 1, SABERTOOTH_GET_CURRENT, 1)
+                     : Q.submitGet(ST, 'M', 1, SABERTOOTH_GET_BATTERY, 0);
+  }
+#else
+  ST.motor(1, value);
+
+  static boolean toggle = false;
+  int result, context;
+  if (C.reply_available(&result, &context))
+  {
+    if (context == 0) { battery  = result; }
+    if (context == 1) { current1 = result; }
+    toggle = !toggle;
+  }
+  if (toggle) { ST.async_getCurrent(1, 1); } else { ST.async_getBattery(1, 0); }
+#endif
+
+  unsigned long step = micros() - start;
+  if (step > worst) { worst = step; }
+
+  if (millis() - report >= 1000)
+  {
+    report = millis();
+    Serial.print("worst step us: "); Serial.print(worst);
+    Serial.print(" dropped sets: "); Serial.print(dropped);
+    Serial.print(" batt: "); Serial.print(battery);
+    Serial.print(" cur1: "); Serial.println(current1);
+    worst = 0;
+  }
+}
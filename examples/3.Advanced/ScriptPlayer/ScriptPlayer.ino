@@ -0,0 +1,66 @@
+// Script Player Sample for USB Sabertooth Packet Serial
+// Plays a pre-recorded motion for two drivers from flash, over and over, without delay():
+// loop() stays free for other work, here reading the battery voltage once a second.
+// The motion is the one of the TankStyleSweep example, in coarser steps, with the second
+// driver mirroring the first.
+
+#include <USBSabertooth_NB.h>
+
+USBSabertoothSerial C; // Use the Arduino TX pin. It connects to S1.
+
+USBSabertooth ST(C, 128); // The drivers are on addresses 128 and 129.
+
+USBSabertoothScriptPlayer player(C);
+
+const byte motion[] PROGMEM =
+{
+  // mixed mode needs both drive and turn before it moves
+  SABERTOOTH_SCRIPT_DRIVE(   0, 128,     0), SABERTOOTH_SCRIPT_TURN(   0, 128,     0),
+  SABERTOOTH_SCRIPT_DRIVE(   0, 129,     0), SABERTOOTH_SCRIPT_TURN(   0, 129,     0),
+  
+  // ramp from backwards to forwards, 250 ms per step
+  SABERTOOTH_SCRIPT_DRIVE( 250, 128, -2047), SABERTOOTH_SCRIPT_DRIVE(   0, 129,  2047),
+  SABERTOOTH_SCRIPT_DRIVE( 250, 128, -1024), SABERTOOTH_SCRIPT_DRIVE(   0, 129,  1024),
+  SABERTOOTH_SCRIPT_DRIVE( 250, 128,     0), SABERTOOTH_SCRIPT_DRIVE(   0, 129,     0),
+  SABERTOOTH_SCRIPT_DRIVE( 250, 128,  1024), SABERTOOTH_SCRIPT_DRIVE(   0, 129, -1024),
+  SABERTOOTH_SCRIPT_DRIVE( 250, 128,  2047), SABERTOOTH_SCRIPT_DRIVE(   0, 129, -2047),
+  
+  // drive at 400 and turn from full left to full right, 500 ms per step
+  SABERTOOTH_SCRIPT_DRIVE( 250, 128,   400), SABERTOOTH_SCRIPT_DRIVE(   0, 129,  -400),
+  SABERTOOTH_SCRIPT_TURN (   0, 128, -2047), SABERTOOTH_SCRIPT_TURN (   0, 129,  2047),
+  SABERTOOTH_SCRIPT_TURN ( 500, 128, -1024), SABERTOOTH_SCRIPT_TURN (   0, 129,  1024),
+  SABERTOOTH_SCRIPT_TURN ( 500, 128,     0), SABERTOOTH_SCRIPT_TURN (   0, 129,     0),
+  SABERTOOTH_SCRIPT_TURN ( 500, 128,  1024), SABERTOOTH_SCRIPT_TURN (   0, 129, -1024),
+  SABERTOOTH_SCRIPT_TURN ( 500, 128,  2047), SABERTOOTH_SCRIPT_TURN (   0, 129, -2047),
+  
+  // stop, and wait 5 seconds before starting over
+  SABERTOOTH_SCRIPT_TURN ( 500, 128,     0), SABERTOOTH_SCRIPT_TURN (   0, 129,     0),
+  SABERTOOTH_SCRIPT_DRIVE(   0, 128,     0), SABERTOOTH_SCRIPT_DRIVE(   0, 129,     0),
+  SABERTOOTH_SCRIPT_END  (5000)
+};
+
+void setup()
+{
+  Serial.begin(9600);
+  SabertoothTXPinSerial.begin(9600); // 9600 is the default baud rate for Sabertooth Packet Serial.
+  
+  player.play(motion, sizeof(motion), true, true);   // from PROGMEM, looping
+  C.setPollInterval(1000);   // the serial asks again every second
+  ST.async_getBattery(1);
+}
+
+void loop()
+{
+  player.run();   // sends the sets that are due
+  
+  int result, context;
+  if (C.reply_available(&result, &context))
+  {
+    if (result != SABERTOOTH_GET_TIMED_OUT && result != SABERTOOTH_GET_ERROR)
+    {
+      Serial.print("battery ");  Serial.print(result);
+      Serial.print(" sets ");    Serial.print(player.sent());
+      Serial.print(" most late, ms "); Serial.println(player.maxLateTicks() / SABERTOOTH_TICKS_PER_MS);
+    }
+  }
+}
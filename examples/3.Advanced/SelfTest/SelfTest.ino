@@ -0,0 +1,806 @@
+// Self Test Sample for USB Sabertooth Packet Serial
+// Checks the bytes the library puts on the line against golden packets, and times the
+// encoding and decoding paths. Run it after changing the library, or on a new board:
+// any FAIL line means packets would be rejected, or misread, by the motor drivers.
+// Golden packets cover every set type and get type with checksum and with CRC, values
+// around SABERTOOTH_MAX_VALUE clamping and negative values, and get replies. They were
+// computed from the Packet Serial specification, not by the library itself. Unit conversion
+// vectors were computed with exact arithmetic, and must match bit for bit on every board.
+// Behaviour checks, against the emulator where a driver is needed:
+//  - a telemetry sweep is reported exactly once, and waits for a bad reply to be cleared
+//  - a shadow refresh never resends a channel that a later command replaced
+//  - a current limiter ignores a reading that arrives after its limit was cleared
+//  - a captured session replays to the same reply, and a full capture drops its oldest records
+//  - a history gives back every value and summary exactly, and a small one the newest values
+//  - a deadline or cancel drops a get not sent yet, and discards the reply of one already sent
+//  - trace time stamps are never negative (needs SABERTOOTH_TRACE=1, skipped otherwise)
+// Timings are printed as CSV: name,iterations,total_us,ns_per_op. With no driver needed,
+// nothing has to be connected.
+
+#include <USBSabertooth_NB.h>
+
+const unsigned ITERATIONS = 1000;
+
+// a port that keeps what is written to it, and reads back a reply
+class Loopback : public Stream
+{
+public:
+  Loopback() : sentLength(0), reply(NULL), replyLength(0), replyRead(0) {}
+  
+  void setReply(const byte* data, byte length) { reply = data; replyLength = length; replyRead = 0; }
+  
+  int    available()            { return replyLength - replyRead; }
+  int    read     ()            { return available() ? reply[replyRead ++] : -1; }
+  int    peek     ()            { return available() ? reply[replyRead] : -1; }
+  void   flush    ()            { }
+  size_t write    (uint8_t data) { if (sentLength < sizeof(sent)) { sent[sentLength ++] = data; } return 1; }
+  using Print::write;
+  
+  byte        sent[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH], sentLength;
+  const byte* reply;
+  byte        replyLength, replyRead;
+};
+
+// kind: 'S' set, 'K' keepAlive, 'D' shutDown, 'T' setTimeout, 'G' get
+struct Golden
+{
+  char    kind;
+  byte    address;
+  boolean crc;
+  byte    type, number;
+  int     value;
+  byte    flags;   // set type, or get type plus 2 for unscaled
+  byte    length;
+  byte    bytes[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+};
+
+const Golden goldens[] PROGMEM =
+{
+  // every set type
+  { 'S', 128, false, 'M', 1,   1000, 0x00,  9, { 0x80, 0x28, 0x00, 0x28, 0x68, 0x07, 0x4d, 0x01, 0x3d } },   // motor checksum
+  { 'K', 128, false, 'M', '*',      0, 0x10,  9, { 0x80, 0x28, 0x10, 0x38, 0x00, 0x00, 0x4d, 0x2a, 0x77 } },   // keepAlive checksum
+  { 'D', 128, false, 'M', 1,   2048, 0x20,  9, { 0x80, 0x28, 0x20, 0x48, 0x00, 0x10, 0x4d, 0x01, 0x5e } },   // shutDown checksum
+  { 'T', 128, false, 'M', '*',   1000, 0x40,  9, { 0x80, 0x28, 0x40, 0x68, 0x68, 0x07, 0x4d, 0x2a, 0x66 } },   // setTimeout checksum
+  { 'S', 130, false, 'M', 'D',   -500, 0x00,  9, { 0x82, 0x28, 0x01, 0x2b, 0x74, 0x03, 0x4d, 0x44, 0x08 } },   // drive checksum
+  { 'S', 135, false, 'P', 2,  -2047, 0x00,  9, { 0x87, 0x28, 0x01, 0x30, 0x7f, 0x0f, 0x50, 0x02, 0x60 } },   // power checksum
+  { 'S', 128, true , 'M', 1,   1000, 0x00, 10, { 0xf0, 0x28, 0x00, 0x0c, 0x68, 0x07, 0x4d, 0x01, 0x5b, 0x0d } },   // motor crc
+  { 'K', 128, true , 'M', '*',      0, 0x10, 10, { 0xf0, 0x28, 0x10, 0x4f, 0x00, 0x00, 0x4d, 0x2a, 0x65, 0x40 } },   // keepAlive crc
+  { 'D', 128, true , 'M', 1,   2048, 0x20, 10, { 0xf0, 0x28, 0x20, 0x67, 0x00, 0x10, 0x4d, 0x01, 0x69, 0x41 } },   // shutDown crc
+  { 'T', 128, true , 'M', '*',   1000, 0x40, 10, { 0xf0, 0x28, 0x40, 0x37, 0x68, 0x07, 0x4d, 0x2a, 0x3a, 0x08 } },   // setTimeout crc
+  { 'S', 130, true , 'M', 'D',   -500, 0x00, 10, { 0xf2, 0x28, 0x01, 0x35, 0x74, 0x03, 0x4d, 0x44, 0x31, 0x1b } },   // drive crc
+  { 'S', 135, true , 'P', 2,  -2047, 0x00, 10, { 0xf7, 0x28, 0x01, 0x63, 0x7f, 0x0f, 0x50, 0x02, 0x7e, 0x13 } },   // power crc
+  
+  // every get type
+  { 'G', 128, false, 'M', 1,      0, 0x00,  7, { 0x80, 0x29, 0x00, 0x29, 0x4d, 0x01, 0x4e } },   // getValue checksum
+  { 'G', 128, false, 'M', 1,      0, 0x10,  7, { 0x80, 0x29, 0x10, 0x39, 0x4d, 0x01, 0x4e } },   // getBattery checksum
+  { 'G', 129, false, 'M', 2,      0, 0x20,  7, { 0x81, 0x29, 0x20, 0x4a, 0x4d, 0x02, 0x4f } },   // getCurrent checksum
+  { 'G', 128, false, 'M', 1,      0, 0x40,  7, { 0x80, 0x29, 0x40, 0x69, 0x4d, 0x01, 0x4e } },   // getTemperature checksum
+  { 'G', 128, false, 'M', 1,      0, 0x22,  7, { 0x80, 0x29, 0x22, 0x4b, 0x4d, 0x01, 0x4e } },   // getCurrent unscaled checksum
+  { 'G', 128, true , 'M', 1,      0, 0x00,  8, { 0xf0, 0x29, 0x00, 0x6d, 0x4d, 0x01, 0x64, 0x3d } },   // getValue crc
+  { 'G', 128, true , 'M', 1,      0, 0x10,  8, { 0xf0, 0x29, 0x10, 0x2e, 0x4d, 0x01, 0x64, 0x3d } },   // getBattery crc
+  { 'G', 129, true , 'M', 2,      0, 0x20,  8, { 0xf1, 0x29, 0x20, 0x7a, 0x4d, 0x02, 0x16, 0x2d } },   // getCurrent crc
+  { 'G', 128, true , 'M', 1,      0, 0x40,  8, { 0xf0, 0x29, 0x40, 0x56, 0x4d, 0x01, 0x64, 0x3d } },   // getTemperature crc
+  { 'G', 128, true , 'M', 1,      0, 0x22,  8, { 0xf0, 0x29, 0x22, 0x5e, 0x4d, 0x01, 0x64, 0x3d } },   // getCurrent unscaled crc
+  
+  // clamping and negative values
+  { 'S', 128, false, 'M', 1,      0, 0x00,  9, { 0x80, 0x28, 0x00, 0x28, 0x00, 0x00, 0x4d, 0x01, 0x4e } },   // set 0 checksum
+  { 'S', 128, false, 'M', 1,      1, 0x00,  9, { 0x80, 0x28, 0x00, 0x28, 0x01, 0x00, 0x4d, 0x01, 0x4f } },   // set 1 checksum
+  { 'S', 128, false, 'M', 1,     -1, 0x00,  9, { 0x80, 0x28, 0x01, 0x29, 0x01, 0x00, 0x4d, 0x01, 0x4f } },   // set -1 checksum
+  { 'S', 128, false, 'M', 1,    127, 0x00,  9, { 0x80, 0x28, 0x00, 0x28, 0x7f, 0x00, 0x4d, 0x01, 0x4d } },   // set 127 checksum
+  { 'S', 128, false, 'M', 1,    128, 0x00,  9, { 0x80, 0x28, 0x00, 0x28, 0x00, 0x01, 0x4d, 0x01, 0x4f } },   // set 128 checksum
+  { 'S', 128, false, 'M', 1,   -128, 0x00,  9, { 0x80, 0x28, 0x01, 0x29, 0x00, 0x01, 0x4d, 0x01, 0x4f } },   // set -128 checksum
+  { 'S', 128, false, 'M', 1,   2047, 0x00,  9, { 0x80, 0x28, 0x00, 0x28, 0x7f, 0x0f, 0x4d, 0x01, 0x5c } },   // set 2047 checksum
+  { 'S', 128, false, 'M', 1,  -2048, 0x00,  9, { 0x80, 0x28, 0x01, 0x29, 0x00, 0x10, 0x4d, 0x01, 0x5e } },   // set -2048 checksum
+  { 'S', 128, false, 'M', 1,  16383, 0x00,  9, { 0x80, 0x28, 0x00, 0x28, 0x7f, 0x7f, 0x4d, 0x01, 0x4c } },   // set 16383 checksum
+  { 'S', 128, false, 'M', 1,  16384, 0x00,  9, { 0x80, 0x28, 0x00, 0x28, 0x7f, 0x7f, 0x4d, 0x01, 0x4c } },   // set 16384 checksum
+  { 'S', 128, false, 'M', 1, -16383, 0x00,  9, { 0x80, 0x28, 0x01, 0x29, 0x7f, 0x7f, 0x4d, 0x01, 0x4c } },   // set -16383 checksum
+  { 'S', 128, false, 'M', 1, -16384, 0x00,  9, { 0x80, 0x28, 0x01, 0x29, 0x7f, 0x7f, 0x4d, 0x01, 0x4c } },   // set -16384 checksum
+  { 'S', 128, false, 'M', 1,  32767, 0x00,  9, { 0x80, 0x28, 0x00, 0x28, 0x7f, 0x7f, 0x4d, 0x01, 0x4c } },   // set 32767 checksum
+  { 'S', 128, false, 'M', 1, -32768, 0x00,  9, { 0x80, 0x28, 0x01, 0x29, 0x7f, 0x7f, 0x4d, 0x01, 0x4c } },   // set -32768 checksum
+  { 'S', 128, true , 'M', 1,    127, 0x00, 10, { 0xf0, 0x28, 0x00, 0x0c, 0x7f, 0x00, 0x4d, 0x01, 0x67, 0x7d } },   // set 127 crc
+  { 'S', 128, true , 'M', 1,    128, 0x00, 10, { 0xf0, 0x28, 0x00, 0x0c, 0x00, 0x01, 0x4d, 0x01, 0x74, 0x2a } },   // set 128 crc
+  { 'S', 128, true , 'M', 1,  16384, 0x00, 10, { 0xf0, 0x28, 0x00, 0x0c, 0x7f, 0x7f, 0x4d, 0x01, 0x30, 0x3c } },   // set 16384 crc
+  { 'S', 128, true , 'M', 1, -32768, 0x00, 10, { 0xf0, 0x28, 0x01, 0x20, 0x7f, 0x7f, 0x4d, 0x01, 0x30, 0x3c } },   // set -32768 crc
+};
+
+struct GoldenReply
+{
+  byte    address;
+  boolean crc;
+  byte    type, number, flags;
+  int     result;
+  byte    length;
+  byte    bytes[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+};
+
+const GoldenReply goldenReplies[] PROGMEM =
+{
+  { 128, false, 'M', 1, 0x10,    240,  9, { 0x80, 0x49, 0x10, 0x59, 0x70, 0x01, 0x4d, 0x01, 0x3f } },
+  { 128, true , 'M', 1, 0x10,    240, 10, { 0xf0, 0x49, 0x10, 0x56, 0x70, 0x01, 0x4d, 0x01, 0x09, 0x3a } },
+  { 129, false, 'M', 2, 0x00,  -1000,  9, { 0x81, 0x49, 0x01, 0x4b, 0x68, 0x07, 0x4d, 0x02, 0x3e } },
+  { 129, true , 'M', 2, 0x00,  -1000, 10, { 0xf1, 0x49, 0x01, 0x45, 0x68, 0x07, 0x4d, 0x02, 0x29, 0x1d } },
+  { 128, true , 'M', 1, 0x20,  16383, 10, { 0xf0, 0x49, 0x20, 0x7e, 0x7f, 0x7f, 0x4d, 0x01, 0x30, 0x3c } },
+  { 128, false, 'M', 1, 0x40, -16383,  9, { 0x80, 0x49, 0x41, 0x0a, 0x7f, 0x7f, 0x4d, 0x01, 0x4c } },
+};
+
+// unit conversions, computed with exact rational arithmetic: raw * scale / 65536 rounded half
+// away from zero, plus bias; fromPoints truncates the scale toward zero
+struct GoldenLinear { int32_t scale, bias; int raw; int32_t expected; };
+
+const GoldenLinear goldenLinears[] PROGMEM =
+{
+  {    65536,      0,   1234,     1234 },
+  {    32768,      0,      1,        1 },
+  {    32768,      0,     -1,       -1 },
+  {    32768,      0,      3,        2 },
+  {    32768,      0,     -3,       -2 },
+  {    98304,   -500,     -7,     -511 },
+  {  -172032,     25,   1001,    -2603 },
+  {    27034,    120,   2047,      964 },
+  {    27034,    120,  -2048,     -725 },
+  {    32767,      0,  32767,    16383 },
+  {   -32767,      0, -32768,    16384 },
+  {   262144, -32768,  32767,    98300 },
+  {        1,      0,  32767,        0 },
+  {        1,      0, -32768,       -1 },
+  {    32768,      0, -32768,   -16384 },
+  {    12345,     -7, -12345,    -2332 },
+  {    65535,      0, -32768,   -32768 },
+};
+
+struct GoldenPoints { int rawA; int32_t unitA; int rawB; int32_t unitB, scale, bias; };
+
+const GoldenPoints goldenPoints[] PROGMEM =
+{
+  {     0,      0,  4095,  30000,   480117,      0 },
+  {   100,  -2000,   900,   6000,   655360,  -3000 },
+  {  -512, -10000,   511,  10000,  1281251,     10 },
+  {  2047,  55000,     0,      0,  1760859,      0 },
+  {    10,      7,    13,      8,    21845,      4 },
+  {  1000,      1, -1000,     -1,       65,      0 },
+  {     0,      0,     3,      1,    21845,      0 },
+};
+
+// a temperature table from raw 200 in steps of 64, interpolated and rounded half up
+const int16_t temperatureTable[] PROGMEM = { -400, -250, -80, 100, 270, 455, 610, 820, 1005 };
+
+struct GoldenDegrees { int raw; int32_t expected; };
+
+const GoldenDegrees goldenDegrees[] PROGMEM =
+{
+  {  -100,  -400 },
+  {     0,  -400 },
+  {   199,  -400 },
+  {   200,  -400 },
+  {   201,  -398 },
+  {   231,  -327 },
+  {   232,  -325 },
+  {   233,  -323 },
+  {   263,  -252 },
+  {   264,  -250 },
+  {   300,  -154 },
+  {   455,   267 },
+  {   500,   397 },
+  {   711,  1002 },
+  {   712,  1005 },
+  {   713,  1005 },
+  {   740,  1005 },
+  {  1000,  1005 },
+  {  5000,  1005 },
+};
+
+unsigned passed, failed, skipped;
+
+void fail(const char* what, int index, const byte* expected, byte expectedLength, const byte* got, byte gotLength)
+{
+  failed ++;
+  Serial.print("FAIL "); Serial.print(what); Serial.print(' '); Serial.println(index);
+  Serial.print("  expected"); for (byte i = 0; i < expectedLength; i ++) { Serial.print(' '); Serial.print(expected[i], HEX); }
+  Serial.println();
+  Serial.print("  got     "); for (byte i = 0; i < gotLength;      i ++) { Serial.print(' '); Serial.print(got     [i], HEX); }
+  Serial.println();
+}
+
+void check(const char* what, int index, const byte* expected, byte expectedLength, const byte* got, byte gotLength)
+{
+  if (expectedLength == gotLength && !memcmp(expected, got, gotLength)) { passed ++; }
+  else { fail(what, index, expected, expectedLength, got, gotLength); }
+}
+
+boolean sendGet(USBSabertooth& ST, byte type, byte number, byte flags, int context)
+{
+  boolean unscaled = flags & 2;
+  switch (flags & ~2)
+  {
+  case SABERTOOTH_GET_BATTERY:     return ST.async_getBattery    (number, context, unscaled);
+  case SABERTOOTH_GET_CURRENT:     return ST.async_getCurrent    (number, context, unscaled);
+  case SABERTOOTH_GET_TEMPERATURE: return ST.async_getTemperature(number, context, unscaled);
+  default:                         return ST.async_get(type, number, context);
+  }
+}
+
+void testPackets()
+{
+  for (unsigned i = 0; i < sizeof(goldens) / sizeof(goldens[0]); i ++)
+  {
+    Golden golden; memcpy_P(&golden, &goldens[i], sizeof(golden));
+    
+    Loopback port;
+    USBSabertoothSerial C(port);
+    USBSabertooth ST(C, golden.address);
+    C.setPollInterval(SABERTOOTH_INFINITE_TIMEOUT);   // gets go out at once
+    if (golden.crc) { ST.useCRC(); } else { ST.useChecksum(); }
+    if (ST.usingCRC() != golden.crc) { skipped ++; continue; }   // integrity mode compiled out
+    
+    switch (golden.kind)
+    {
+    case 'S': ST.set(golden.type, golden.number, golden.value); break;
+    case 'K': ST.keepAlive(); break;
+    case 'D': ST.shutDown(golden.type, golden.number, true); break;
+    case 'T': ST.setTimeout(golden.value); break;
+    case 'G': sendGet(ST, golden.type, golden.number, golden.flags, 0); break;
+    }
+    check("packet", i, golden.bytes, golden.length, port.sent, port.sentLength);
+    
+    // the encoder on its own
+    byte data[5], buffer[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+    size_t dataLength = golden.length - (golden.crc ? 5 : 4);
+    data[0] = golden.bytes[2];
+    memcpy(data + 1, golden.bytes + 4, dataLength - 1);
+    size_t length = USBSabertoothCommandWriter::writeToBuffer(buffer, golden.address, (USBSabertoothCommand)golden.bytes[1],
+                                                             golden.crc, data, dataLength);
+    check("writeToBuffer", i, golden.bytes, golden.length, buffer, length);
+  }
+}
+
+void testReplies()
+{
+  for (unsigned i = 0; i < sizeof(goldenReplies) / sizeof(goldenReplies[0]); i ++)
+  {
+    GoldenReply golden; memcpy_P(&golden, &goldenReplies[i], sizeof(golden));
+    
+    for (byte mismatch = 0; mismatch < 2; mismatch ++)   // the reply to another get is an error
+    {
+      Loopback port;
+      USBSabertoothSerial C(port);
+      USBSabertooth ST(C, golden.address);
+      C.setPollInterval(SABERTOOTH_INFINITE_TIMEOUT);
+      if (golden.crc) { ST.useCRC(); } else { ST.useChecksum(); }
+      if (ST.usingCRC() != golden.crc) { skipped ++; break; }
+      
+      sendGet(ST, golden.type, golden.number ^ mismatch, golden.flags, 42);
+      port.setReply(golden.bytes, golden.length);
+      
+      int result = 0, context = 0;
+      boolean done = C.reply_available(&result, &context);
+      int expected = mismatch ? SABERTOOTH_GET_ERROR : golden.result;
+      if (done && result == expected && context == (mismatch ? SABERTOOTH_GET_ERROR : 42)) { passed ++; continue; }
+      
+      failed ++;
+      Serial.print("FAIL reply "); Serial.print(i); Serial.print(mismatch ? " mismatched" : "");
+      Serial.print(" expected "); Serial.print(expected); Serial.print(" got "); Serial.println(done ? result : -1);
+    }
+  }
+}
+
+void testChecks()
+{
+  // check values of the three integrity codes over "123456789"
+  const byte text[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  byte got[3] = { USBSabertoothChecksum::value(text, 9), USBSabertoothCRC7::value(text, 9), 0 };
+  const byte expected[3] = { 0x5d, 0x32, 0 };
+  check("checksum", 0, expected, 1, got, 1);
+  check("crc7", 0, expected + 1, 1, got + 1, 1);
+  
+  uint16_t crc14 = USBSabertoothCRC14::value(text, 9);
+  if (crc14 == 0x2669) { passed ++; }
+  else { failed ++; Serial.print("FAIL crc14 0 expected 2669 got "); Serial.println(crc14, HEX); }
+}
+
+void checkValue(const char* what, int index, int32_t expected, int32_t got)
+{
+  if (expected == got) { passed ++; return; }
+  failed ++;
+  Serial.print("FAIL "); Serial.print(what); Serial.print(' '); Serial.print(index);
+  Serial.print(" expected "); Serial.print(expected); Serial.print(" got "); Serial.println(got);
+}
+
+void testUnits()
+{
+  for (unsigned i = 0; i < sizeof(goldenLinears) / sizeof(goldenLinears[0]); i ++)
+  {
+    GoldenLinear golden; memcpy_P(&golden, &goldenLinears[i], sizeof(golden));
+    USBSabertoothLinear linear = { golden.scale, golden.bias };
+    checkValue("convert", i, golden.expected, linear.convert(golden.raw));
+  }
+  
+  for (unsigned i = 0; i < sizeof(goldenPoints) / sizeof(goldenPoints[0]); i ++)
+  {
+    GoldenPoints golden; memcpy_P(&golden, &goldenPoints[i], sizeof(golden));
+    USBSabertoothLinear linear = USBSabertoothLinear::fromPoints(golden.rawA, golden.unitA, golden.rawB, golden.unitB);
+    checkValue("fromPoints scale", i, golden.scale, linear.scale);
+    checkValue("fromPoints bias",  i, golden.bias,  linear.bias);
+  }
+  
+  USBSabertoothUnits units;
+  units.setTemperatureTable(temperatureTable, sizeof(temperatureTable) / sizeof(temperatureTable[0]), 200, 6);
+  for (unsigned i = 0; i < sizeof(goldenDegrees) / sizeof(goldenDegrees[0]); i ++)
+  {
+    GoldenDegrees golden; memcpy_P(&golden, &goldenDegrees[i], sizeof(golden));
+    checkValue("decidegrees", i, golden.expected, units.decidegrees(golden.raw));
+  }
+}
+
+void testSweep()
+{
+  // a sweep is answered by an emulated driver, and reported exactly once
+  USBSabertoothEmulator line(115200);
+  USBSabertoothSerial C(line);
+  USBSabertooth ST(C, 128);
+  USBSabertoothTelemetry telemetry;
+  C.setPollInterval(20);
+  ST.async_getTelemetry(&telemetry, 7);
+  
+  unsigned replies = 0; int result = 0, context = 0;
+  for (uint32_t start = millis(); millis() - start < 500; )
+  {
+    int r, c;
+    if (C.reply_available(&r, &c)) { replies ++; result = r; context = c; }
+  }
+  if (replies == 1 && result == SABERTOOTH_TELEMETRY_ALL && context == 7) { passed ++; }
+  else
+  {
+    failed ++;
+    Serial.print("FAIL sweep replies "); Serial.print(replies);
+    Serial.print(" result "); Serial.print(result); Serial.print(" context "); Serial.println(context);
+  }
+  
+  // after a mismatched reply the next get of the sweep waits until its trailing bytes are
+  // cleared, a few at a time under a budget, so they can not be taken for its reply
+  Loopback port;
+  USBSabertoothSerial B(port);
+  USBSabertooth BT(B, 128);
+  B.setPollInterval(SABERTOOTH_INFINITE_TIMEOUT);
+  B.setBudget(4);
+  BT.async_getTelemetry(&telemetry, 8);
+  
+  byte reply[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH + 16] = { 0 };
+  const byte data[5] = { SABERTOOTH_GET_BATTERY, 0, 0, 'M', 2 };   // the sweep asked for M1
+  byte length = USBSabertoothCommandWriter::writeToBuffer(reply, 128, (USBSabertoothCommand)SABERTOOTH_RC_GET,
+                                                          BT.usingCRC(), data, 5);
+  port.setReply(reply, length + 16);
+  port.sentLength = 0;
+  
+  boolean early = false;
+  for (byte i = 0; i < 20; i ++)
+  {
+    int r, c;
+    B.reply_available(&r, &c);
+    if (port.sentLength && port.available()) { early = true; }
+  }
+  if (!early && port.sentLength && !port.available()) { passed ++; return; }
+  
+  failed ++;
+  Serial.print("FAIL sweep sent while clearing "); Serial.println(port.available());
+}
+
+void testShadow()
+{
+  // a refresh never resends a channel a later command replaced
+  Loopback port;
+  USBSabertoothSerial C(port);
+  USBSabertooth ST(C, 128);
+  USBSabertoothShadow shadow(0);   // a refresh on every call
+  ST.setShadow(&shadow);
+  
+  const struct { byte type, number; int value; } steps[] =
+  {
+    { 'M', 1,   1500 }, { 'M', 'D',    0 }, { 'M', 'T',    0 },   // motor, then drive and turn
+    { 'M', '*',  300 },                                          // back to motors, both at once
+    { 'P', '*', -200 }, { 'P', 2,    100 }                       // both power outputs, then one
+  };
+  const struct { byte type, number; int value; } expected[][4] =
+  {
+    { { 'M', 1,   1500 } },
+    { { 'M', 'D',    0 } },
+    { { 'M', 'D',    0 }, { 'M', 'T',    0 } },
+    { { 'M', 1,    300 }, { 'M', 2,    300 } },
+    { { 'M', 1,    300 }, { 'M', 2,    300 }, { 'P', 1, -200 }, { 'P', 2, -200 } },
+    { { 'M', 1,    300 }, { 'M', 2,    300 }, { 'P', 1, -200 }, { 'P', 2,  100 } }
+  };
+  
+  for (byte i = 0; i < sizeof(steps) / sizeof(steps[0]); i ++)
+  {
+    ST.set(steps[i].type, steps[i].number, steps[i].value);
+    
+    // every remembered channel, and only those, comes back with its last value
+    byte seen = 0; boolean ok = true;
+    for (byte r = 0; r < 2 * SABERTOOTH_SHADOW_CHANNELS; r ++)
+    {
+      port.sentLength = 0;
+      ST.refresh();
+      USBSabertoothPacket packet;
+      USBSabertoothPacketDecoder::parse(port.sent, port.sentLength, &packet);
+      
+      byte j = 0;
+      for (; j < 4 && expected[i][j].type; j ++)
+      {
+        if (packet.type == expected[i][j].type && packet.number == expected[i][j].number) { break; }
+      }
+      if (!packet.valid || j == 4 || !expected[i][j].type || packet.value != expected[i][j].value) { ok = false; break; }
+      seen |= 1 << j;
+    }
+    byte all = 0; for (byte j = 0; j < 4 && expected[i][j].type; j ++) { all |= 1 << j; }
+    if (ok && seen == all) { passed ++; continue; }
+    
+    failed ++;
+    Serial.print("FAIL shadow "); Serial.println(i);
+  }
+}
+
+void testCurrentLimiter()
+{
+  // a reading arriving after clearLimit no longer scales the output down
+  USBSabertoothEmulator line(115200);
+  USBSabertoothSerial C(line);
+  USBSabertooth ST(C, 128);
+  USBSabertoothCurrentLimiter limiter(C, ST);
+  line.setReadings(240, 30, 100);
+  C.setPollInterval(SABERTOOTH_INFINITE_TIMEOUT);   // gets go out at once
+  
+  limiter.setLimit(1, 10);
+  limiter.motor(1, 2000);
+  limiter.run();            // a current get is now in flight
+  limiter.clearLimit(1);
+  for (uint32_t start = millis(); millis() - start < 100; ) { limiter.run(); }
+  
+  if (line.value(128, 'M', 1) == 2000 && !limiter.limiting(1) && limiter.updates() == 0) { passed ++; return; }
+  
+  failed ++;
+  Serial.print("FAIL limiter power "); Serial.print(line.value(128, 'M', 1));
+  Serial.print(" updates "); Serial.println(limiter.updates());
+}
+
+uint32_t virtualTicks = 0;
+uint32_t virtualClock() { return virtualTicks; }
+
+// runs a set and a battery get on a serial, returns the reply or SABERTOOTH_GET_TIMED_OUT
+int session(USBSabertoothSerial& C, int power)
+{
+  USBSabertooth ST(C, 128);
+  C.setPollInterval(SABERTOOTH_INFINITE_TIMEOUT);
+  ST.motor(1, power);
+  ST.async_getBattery(1, 3);
+  for (int i = 0; i < 1000; i ++, virtualTicks += SABERTOOTH_TICKS_PER_MS)
+  {
+    int result, context;
+    if (C.reply_available(&result, &context)) { return result; }
+  }
+  return SABERTOOTH_GET_TIMED_OUT;
+}
+
+// the value of a captured packet, or SABERTOOTH_GET_ERROR if it is not valid
+int capturedValue(const USBSabertoothCaptureRecord& record)
+{
+  USBSabertoothPacket packet;
+  USBSabertoothPacketDecoder::parse(record.data, record.length, &packet);
+  return packet.valid ? packet.value : SABERTOOTH_GET_ERROR;
+}
+
+void testCapture()
+{
+  USBSabertoothTimeout::setClock(virtualClock);
+  
+  // a session against the emulator is captured as set, get and reply
+  byte storage[128];
+  USBSabertoothCapture capture(storage, sizeof(storage));
+  USBSabertoothEmulator line(115200);
+  USBSabertoothSerial C(line);
+  C.setCapture(&capture);
+  int result = session(C, 500);
+  
+  const byte directions[3] = { SABERTOOTH_CAPTURE_TX, SABERTOOTH_CAPTURE_TX, SABERTOOTH_CAPTURE_RX };
+  const int  values    [3] = { 500, 0, result };
+  size_t position = 0; USBSabertoothCaptureRecord record; byte count = 0; boolean ok = result >= 0;
+  while (capture.read(&position, &record))
+  {
+    if (count >= 3 || record.direction != directions[count] || capturedValue(record) != values[count]) { ok = false; }
+    count ++;
+  }
+  if (ok && count == 3) { passed ++; }
+  else { failed ++; Serial.print("FAIL capture records "); Serial.println(count); }
+  
+  // replaying it reproduces the reply, and checks what is written against the capture
+  USBSabertoothReplay replay(capture);
+  USBSabertoothSerial R(replay);
+  int replayed = session(R, 500);
+  if (replayed == result && replay.mismatches() == 0 && replay.finished()) { passed ++; }
+  else { failed ++; Serial.print("FAIL replay result "); Serial.print(replayed); Serial.print(" mismatches "); Serial.println(replay.mismatches()); }
+  
+  replay.rewind();
+  session(R, 501);
+  if (replay.mismatches()) { passed ++; }
+  else { failed ++; Serial.println("FAIL replay mismatch not counted"); }
+  
+  // when the storage is full the oldest records go first
+  byte small[40];
+  USBSabertoothCapture recent(small, sizeof(small));
+  USBSabertoothSerial S(line);
+  USBSabertooth ST(S, 128);
+  S.setCapture(&recent);
+  for (int power = 1; power <= 5; power ++) { ST.motor(1, power); }
+  
+  position = 0; count = 0; int last = 0; ok = true;
+  while (recent.read(&position, &record))
+  {
+    if (capturedValue(record) != last + 1 && count) { ok = false; }
+    last = capturedValue(record); count ++;
+  }
+  if (ok && count && last == 5) { passed ++; }
+  else { failed ++; Serial.print("FAIL capture wrap records "); Serial.print(count); Serial.print(" last "); Serial.println(last); }
+  
+  USBSabertoothTimeout::setClock(NULL);
+}
+
+int      historyValue(int i)      { return (i * 37) % 200 - 100; }
+uint32_t historyTime (int i)      { return 1000 + (uint32_t)i * 20 + (uint32_t)(i / 5) * 70000; }   // small and large steps
+
+void testHistory()
+{
+  // every value comes back exactly, and buckets summarize the older ones
+  byte storage[512]; USBSabertoothBucket buckets[3];
+  USBSabertoothHistory history(storage, sizeof(storage), buckets, 3, 8);
+  for (int i = 0; i < 40; i ++) { history.add(historyValue(i), historyTime(i)); }
+  
+  USBSabertoothHistoryIterator iterator; USBSabertoothSample sample; int count = 0; boolean ok = true;
+  history.begin(&iterator);
+  while (history.next(&iterator, &sample))
+  {
+    if (sample.value != historyValue(count) || sample.time != historyTime(count)) { ok = false; }
+    count ++;
+  }
+  if (ok && count == 40 && history.samples() == 40) { passed ++; }
+  else { failed ++; Serial.print("FAIL history values "); Serial.println(count); }
+  
+  // 40 values in buckets of 8 fill 5 buckets, the last 3 are kept
+  ok = history.bucketsUsed() == 3;
+  for (byte b = 0; ok && b < 3; b ++)
+  {
+    USBSabertoothBucket bucket; history.bucket(b, &bucket);
+    int first = (b + 2) * 8, low = historyValue(first), high = low; int32_t sum = 0;
+    for (int i = first; i < first + 8; i ++)
+    {
+      int value = historyValue(i);
+      if (value < low ) { low  = value; }
+      if (value > high) { high = value; }
+      sum += value;
+    }
+    ok = bucket.time == historyTime(first) && bucket.min == low && bucket.max == high && bucket.avg == sum / 8;
+  }
+  if (ok) { passed ++; }
+  else { failed ++; Serial.println("FAIL history buckets"); }
+  
+  // a small storage keeps the newest values, without gaps
+  byte small[16];
+  USBSabertoothHistory recent(small, sizeof(small));
+  for (int i = 0; i < 40; i ++) { recent.add(historyValue(i), historyTime(i)); }
+  
+  int first = 40 - (int)recent.samples(); count = 0; ok = recent.samples() > 1 && recent.samples() < 40;
+  recent.begin(&iterator);
+  while (recent.next(&iterator, &sample))
+  {
+    if (sample.value != historyValue(first + count) || sample.time != historyTime(first + count)) { ok = false; }
+    count ++;
+  }
+  if (ok && first + count == 40) { passed ++; }
+  else { failed ++; Serial.print("FAIL history recent "); Serial.println(count); }
+}
+
+// runs a serial for some milliseconds of virtual time, returns how many replies it reported
+byte pump(USBSabertoothSerial& C, uint16_t ms, int* result, int* context)
+{
+  byte replies = 0;
+  for (uint16_t i = 0; i < ms; i ++, virtualTicks += SABERTOOTH_TICKS_PER_MS)
+  {
+    if (C.reply_available(result, context)) { replies ++; }
+  }
+  return replies;
+}
+
+void testDeadline()
+{
+  USBSabertoothTimeout::setClock(virtualClock);
+  
+  // a get still waiting for the poll interval is dropped at its deadline, without being sent
+  USBSabertoothEmulator line(115200);
+  USBSabertoothSerial C(line);
+  USBSabertooth ST(C, 128);
+  int result = 0, context = 0;
+  C.setPollInterval(30);   // within SABERTOOTH_MAX_INTERVAL of every build
+  ST.async_getBattery(1, 1);
+  byte first = pump(C, 5, &result, &context);
+  
+  uint32_t packets = line.packets();
+  ST.async_getBattery(1, 2);
+  boolean ok = first == 1 && C.setDeadline(2, 10) && !C.setDeadline(9, 10);
+  ok = ok && pump(C, 8, &result, &context) == 0;
+  ok = ok && pump(C, 4, &result, &context) == 1 && result == SABERTOOTH_GET_TIMED_OUT;
+  if (ok && line.packets() == packets) { passed ++; }
+  else { failed ++; Serial.print("FAIL deadline packets "); Serial.println(line.packets() - packets); }
+  
+  // a waiting get cancelled is never sent nor reported
+  ST.async_getBattery(1, 3);
+  ok = C.cancel(3) && !C.cancel(3);
+  ok = ok && pump(C, 200, &result, &context) == 0;
+  if (ok && line.packets() == packets) { passed ++; }
+  else { failed ++; Serial.print("FAIL cancel waiting packets "); Serial.println(line.packets() - packets); }
+  
+  // a get on the line cancelled has its reply discarded, and the next get is accepted after it
+  C.setPollInterval(SABERTOOTH_INFINITE_TIMEOUT);   // gets go out at once
+  ST.async_getBattery(1, 4);
+  ok = line.packets() == packets + 1 && C.cancel(4) && !ST.async_getBattery(1, 5);
+  ok = ok && pump(C, 50, &result, &context) == 0;
+  ok = ok && ST.async_getBattery(1, 5) && pump(C, 50, &result, &context) == 1;
+  if (ok && context == 5 && result >= 0) { passed ++; }
+  else { failed ++; Serial.print("FAIL cancel in flight context "); Serial.println(context); }
+  
+  // the arbiter drops a cancelled get, and times out a silent driver at its deadline
+  USBSabertoothEmulator shared(115200);
+  USBSabertoothSerial S(shared);
+  USBSabertooth ST1(S, 128), ST2(S, 129), ST3(S, 130);
+  USBSabertoothArbiter A(S, 115200);
+  shared.setAddresses(3);   // 130 does not answer
+  A.setGetTimeout(1000);
+  A.async_get(ST1, 'M', 1, SABERTOOTH_GET_BATTERY, 1);
+  A.async_get(ST2, 'M', 1, SABERTOOTH_GET_BATTERY, 2);
+  A.async_get(ST3, 'M', 1, SABERTOOTH_GET_BATTERY, 3);
+  ok = A.cancel(2) && A.setDeadline(3, 20) && !A.setDeadline(2, 20);
+  
+  byte replies = 0; int contexts = 0; uint32_t timedOut = 0, start = virtualTicks;
+  for (uint16_t i = 0; i < 100; i ++, virtualTicks += SABERTOOTH_TICKS_PER_MS)
+  {
+    if (!A.reply_available(&result, &context)) { continue; }
+    replies ++;
+    if (result == SABERTOOTH_GET_TIMED_OUT) { timedOut = virtualTicks - start; }
+    else { contexts += context; }
+  }
+  ok = ok && replies == 2 && contexts == 1;
+  ok = ok && timedOut >= 20UL * SABERTOOTH_TICKS_PER_MS && timedOut < 25UL * SABERTOOTH_TICKS_PER_MS;
+  if (ok) { passed ++; }
+  else { failed ++; Serial.print("FAIL arbiter deadline replies "); Serial.print(replies); Serial.print(" timed out "); Serial.println(timedOut); }
+  
+  USBSabertoothTimeout::setClock(NULL);
+}
+
+// a Print that keeps what is printed to it
+class Text : public Print
+{
+public:
+  Text() : length(0) { text[0] = 0; }
+  
+  size_t write(uint8_t data) { if (length < sizeof(text) - 1) { text[length ++] = data; text[length] = 0; } return 1; }
+  using Print::write;
+  
+  char     text[512];
+  unsigned length;
+};
+
+void testTrace()
+{
+#if SABERTOOTH_TRACE
+  // a span is stored when it ends, after the mark nested in it, yet no time stamp is negative
+  USBSabertoothTrace::clear();
+  USBSabertoothTrace::record(SABERTOOTH_TRACE_FRAME, &passed, 10, 128, SABERTOOTH_RC_GET);
+  USBSabertoothTrace::record(SABERTOOTH_TRACE_READ,  &passed,  5,   9, 1);
+  
+  Text json;
+  USBSabertoothTrace::writeJSON(json);
+  USBSabertoothTrace::clear();
+  
+  const uint32_t expected[2] = { 5UL * (1000 / SABERTOOTH_TICKS_PER_MS), 0 };
+  const char* at = json.text; byte found = 0; boolean ok = true;
+  while ((at = strstr(at, "\"ts\":")) != NULL)
+  {
+    at += 5;
+    if (found >= 2 || strtoul(at, NULL, 10) != expected[found]) { ok = false; }
+    found ++;
+  }
+  if (ok && found == 2) { passed ++; return; }
+  
+  failed ++;
+  Serial.print("FAIL trace "); Serial.println(json.text);
+#else
+  skipped ++;   // trace points compiled out
+#endif
+}
+
+// benchmarks
+const byte   setData[5] = { 0x00, 0x68, 0x07, 'M', 1 };
+volatile int sink;
+Loopback            benchPort;
+USBSabertoothSerial benchSerial(benchPort);
+USBSabertooth       benchST(benchSerial, 128);
+byte         benchBuffer[SABERTOOTH_COMMAND_MAX_BUFFER_LENGTH];
+const byte   benchReply[] = { 0xf0, 0x49, 0x10, 0x56, 0x70, 0x01, 0x4d, 0x01, 0x09, 0x3a };
+
+void opNothing () { }
+void opChecksum() { sink = USBSabertoothChecksum::value(setData + 1, 4); }
+void opCRC7    () { sink = USBSabertoothCRC7::value(setData, 3); }
+void opCRC14   () { sink = USBSabertoothCRC14::value(setData + 1, 4); }
+void opEncodeChecksum() { sink = USBSabertoothCommandWriter::writeToBuffer(benchBuffer, 128, SABERTOOTH_CMD_SET, false, setData, 5); }
+void opEncodeCRC     () { sink = USBSabertoothCommandWriter::writeToBuffer(benchBuffer, 128, SABERTOOTH_CMD_SET, true,  setData, 5); }
+void opDecode() 
+{
+  USBSabertoothPacket packet;
+  USBSabertoothPacketDecoder::parse(benchReply, sizeof(benchReply), &packet);
+  sink = packet.value;
+}
+void opSet()
+{
+  benchPort.sentLength = 0;
+  benchST.motor(1, 1000);
+}
+void opReply()
+{
+  benchPort.sentLength = 0;
+  benchST.async_getBattery(1);
+  benchPort.setReply(benchReply, sizeof(benchReply));
+  int result, context;
+  benchSerial.reply_available(&result, &context);
+  sink = result;
+}
+
+typedef void (*Operation)();
+
+uint32_t timeOf(Operation op)
+{
+  uint32_t start = micros();
+  for (unsigned i = 0; i < ITERATIONS; i ++) { op(); }
+  return micros() - start;
+}
+
+void bench(const char* name, Operation op, uint32_t overhead)
+{
+  uint32_t total = timeOf(op);
+  total = total > overhead ? total - overhead : 0;
+  Serial.print(name);       Serial.print(',');
+  Serial.print(ITERATIONS); Serial.print(',');
+  Serial.print(total);      Serial.print(',');
+  Serial.println(total * 1000UL / ITERATIONS);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  
+  testPackets();
+  testReplies();
+  testChecks();
+  testUnits();
+  testSweep();
+  testShadow();
+  testCurrentLimiter();
+  testCapture();
+  testHistory();
+  testDeadline();
+  testTrace();
+  Serial.print("golden: "); Serial.print(passed);  Serial.print(" passed, ");
+  Serial.print(failed);     Serial.print(" failed, ");
+  Serial.print(skipped);    Serial.println(" skipped");
+  
+  benchSerial.setPollInterval(SABERTOOTH_INFINITE_TIMEOUT);
+  uint32_t overhead = timeOf(opNothing);
+  Serial.println("name,iterations,total_us,ns_per_op");
+  bench("checksum",          opChecksum,       overhead);
+  bench("crc7",              opCRC7,           overhead);
+  bench("crc14",             opCRC14,          overhead);
+  bench("encode_checksum",   opEncodeChecksum, overhead);
+  bench("encode_crc",        opEncodeCRC,      overhead);
+  bench("set",               opSet,            overhead);
+  bench("decode_reply",      opDecode,         overhead);
+  bench("get_reply_match",   opReply,          overhead);
+}
+
+void loop()
+{
+}
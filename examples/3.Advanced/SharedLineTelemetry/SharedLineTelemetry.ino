@@ -0,0 +1,38 @@
+// Shared Line Telemetry Sample for USB Sabertooth Packet Serial
+// Reads the motor 1 current of three motor drivers sharing one line, letting a
+// USBSabertoothArbiter overlap the gets so no driver waits for the others' replies.
+// This example assumes a board with Serial and Serial1 interfaces (only required for display purposes)
+
+#include <USBSabertooth_NB.h>
+
+USBSabertoothSerial  C;
+USBSabertooth        ST[3] = { USBSabertooth(C, 128), USBSabertooth(C, 129), USBSabertooth(C, 130) };
+USBSabertoothArbiter arbiter(C, 9600);   // must match the baud rate of the line
+
+int next = 0;
+
+void setup()
+{
+  Serial.begin(9600);
+  SabertoothTXPinSerial.begin(9600);
+  
+  arbiter.setGetTimeout(100);
+}
+
+void loop()
+{
+  // keep the arbiter full, the context tells the drivers apart
+  while (arbiter.async_get(ST[next], 'M', 1, SABERTOOTH_GET_CURRENT, next))
+  {
+    next = (next + 1) % 3;
+  }
+  
+  int current, driver;
+  if (arbiter.reply_available(&current, &driver))
+  {
+    Serial.print("Driver "); Serial.print(128 + driver);
+    Serial.print(" Cur1:");
+    if (current == SABERTOOTH_GET_TIMED_OUT) { Serial.println("timed out"); }
+    else                                     { Serial.println(current); }
+  }
+}
@@ -0,0 +1,98 @@
+// Simulation Sample for USB Sabertooth Packet Serial
+// Compares get poll intervals over an hour of robot operation, simulated in seconds.
+// A USBSabertoothSimulation drives the clock; the application loop runs as a periodic
+// event with jitter, against two emulated drivers on one 38400 baud line. Every run with
+// the same seed sees exactly the same traffic, so the configurations can be compared
+// one to one; the first configuration is run twice to show it. One CSV line per run:
+//   poll_ms,seed,sets,replies,timeouts,mean_latency_ticks,tx_util_pct,rx_util_pct
+// Each run starts from fresh objects: state left over from a previous run would make
+// the runs differ.
+
+#include <USBSabertooth_NB.h>
+
+const uint32_t MINUTES    = 60;
+const uint32_t SEED       = 12345;
+const int32_t  POLLS_MS[] = { 100, 100, 20, 0 };
+
+USBSabertoothEmulator line(38400);
+
+struct Robot
+{
+  Robot() : C(line), ST { USBSabertooth(C, 128), USBSabertooth(C, 129) } {}
+  
+  USBSabertoothSimulation* simulation;
+  USBSabertoothSerial      C;
+  USBSabertooth            ST[2];
+  uint32_t sets = 0, replies = 0, timeouts = 0, latencySum = 0, issued = 0, nextSet = 0;
+  byte     next = 0;
+  boolean  waiting = false;
+};
+
+// the application loop, as it would run on the robot
+void robotLoop(void* user)
+{
+  Robot& robot = *(Robot*)user;
+  uint32_t now = USBSabertoothTimeout::now();
+  
+  if ((int32_t)(now - robot.nextSet) >= 0)   // new setpoints at 50 Hz
+  {
+    for (byte d = 0; d < 2; d ++) { robot.ST[d].motor(1, (int)robot.simulation->random(4095) - 2047); }
+    robot.sets += 2; robot.nextSet += 20 * SABERTOOTH_TICKS_PER_MS;
+  }
+  
+  if (!robot.waiting && robot.ST[robot.next].async_getCurrent(1, robot.next))
+  {
+    robot.waiting = true; robot.issued = now; robot.next ^= 1;
+  }
+  
+  int result, context;
+  if (robot.C.reply_available(&result, &context))
+  {
+    robot.waiting = false;
+    if (result == SABERTOOTH_GET_TIMED_OUT) { robot.timeouts ++; }
+    else                                    { robot.replies ++; robot.latencySum += now - robot.issued; }
+  }
+}
+
+void run(int32_t pollMS)
+{
+  USBSabertoothSimulation sim(SEED);
+  sim.begin();
+  line.reset();
+  
+  Robot robot;
+  robot.simulation = &sim;
+  robot.C.setPollInterval(pollMS);
+  robot.C.setGetTimeout(200);
+  
+  // loop() every 1 ms, up to half a millisecond late
+  sim.schedule(robotLoop, &robot, 0, SABERTOOTH_TICKS_PER_MS, SABERTOOTH_TICKS_PER_MS / 2);
+  sim.run(MINUTES * 60000UL * SABERTOOTH_TICKS_PER_MS);
+  
+  uint32_t elapsedMicros = MINUTES * 60000000UL;
+  Serial.print(pollMS);         Serial.print(',');
+  Serial.print(SEED);           Serial.print(',');
+  Serial.print(robot.sets);     Serial.print(',');
+  Serial.print(robot.replies);  Serial.print(',');
+  Serial.print(robot.timeouts); Serial.print(',');
+  Serial.print(robot.replies ? robot.latencySum / robot.replies : 0); Serial.print(',');
+  Serial.print(line.txBusyMicros() / (elapsedMicros / 100)); Serial.print(',');
+  Serial.println(line.rxBusyMicros() / (elapsedMicros / 100));
+  
+  sim.end();
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  
+  Serial.println("poll_ms,seed,sets,replies,timeouts,mean_latency_ticks,tx_util_pct,rx_util_pct");
+  for (byte i = 0; i < sizeof(POLLS_MS) / sizeof(POLLS_MS[0]); i ++)
+  {
+    run(POLLS_MS[i]);
+  }
+}
+
+void loop()
+{
+}
@@ -0,0 +1,71 @@
+// Tasks Sample for USB Sabertooth Packet Serial
+// Two independent pieces of logic written as plain sequential code, each waiting for its own
+// get replies, without blocking each other or the rest of loop().
+// This example assumes a board with Serial and Serial1 interfaces (only required for display purposes)
+
+#include <USBSabertooth_NB.h>
+
+USBSabertoothSerial    C;
+USBSabertooth          ST(C, 128);
+USBSabertoothScheduler scheduler(C);
+
+// Reports battery and motor 1 current twice a second
+class Report : public USBSabertoothTask
+{
+  void run()
+  {
+    SABERTOOTH_TASK_BEGIN();
+    for (;;)
+    {
+      SABERTOOTH_AWAIT(ST.async_getBattery(1));
+      battery = result;
+      SABERTOOTH_AWAIT(ST.async_getCurrent(1));
+      Serial.print("Batt:"); Serial.print(battery);
+      Serial.print(" Cur1:"); Serial.println(result);
+      SABERTOOTH_SLEEP(500);
+    }
+    SABERTOOTH_TASK_END();
+  }
+  
+  int battery;   // members, not locals, survive SABERTOOTH_AWAIT
+};
+
+// Ramps motor 1 up, stops it if the current gets too high, and ends
+class Ramp : public USBSabertoothTask
+{
+  void run()
+  {
+    SABERTOOTH_TASK_BEGIN();
+    for (power = 0; power <= 2047; power += 64)
+    {
+      ST.motor(1, power);
+      SABERTOOTH_AWAIT(ST.async_getCurrent(1));
+      if (result != SABERTOOTH_GET_TIMED_OUT && result != SABERTOOTH_GET_ERROR && result > 200) { break; }
+      SABERTOOTH_SLEEP(50);
+    }
+    ST.motor(1, 0);
+    Serial.println("Ramp done");
+    SABERTOOTH_TASK_END();
+  }
+  
+  int power;
+};
+
+Report report;
+Ramp   ramp;
+
+void setup()
+{
+  Serial.begin(9600);
+  SabertoothTXPinSerial.begin(9600);
+  
+  scheduler.add(report);
+  scheduler.add(ramp);
+}
+
+void loop()
+{
+  scheduler.run();
+  
+  // anything else runs here as usual
+}
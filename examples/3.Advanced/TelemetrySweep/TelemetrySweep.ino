@@ -0,0 +1,38 @@
+// Telemetry Sweep Sample for USB Sabertooth Packet Serial
+// Collects battery, motor values, currents and temperatures with a single non-blocking sweep,
+// instead of one async get per value as in the NonBlockingExample.
+// This example assumes a board with Serial and Serial1 interfaces (only required for display purposes)
+
+#include <USBSabertooth_NB.h>
+
+USBSabertoothSerial    C;
+USBSabertooth          ST(C, 128);
+USBSabertoothTelemetry telemetry;
+
+void setup()
+{
+  Serial.begin(9600);
+  SabertoothTXPinSerial.begin(9600);
+  
+  ST.async_getTelemetry(&telemetry);  // request all fields
+}
+
+void loop()
+{
+  int valid, context;
+  
+  if (C.reply_available(&valid, &context))
+  {
+    if (context == 0)   // context 0 is our sweep, valid has a bit set for every field received
+    {
+      if (telemetry.isValid(SABERTOOTH_TELEMETRY_BATTERY))      { Serial.print("Batt:"); Serial.print(telemetry.battery());       Serial.print(' '); }
+      if (telemetry.isValid(SABERTOOTH_TELEMETRY_CURRENT1))     { Serial.print("Cur1:"); Serial.print(telemetry.current(1));      Serial.print(' '); }
+      if (telemetry.isValid(SABERTOOTH_TELEMETRY_CURRENT2))     { Serial.print("Cur2:"); Serial.print(telemetry.current(2));      Serial.print(' '); }
+      if (telemetry.isValid(SABERTOOTH_TELEMETRY_TEMPERATURE1)) { Serial.print("Tmp1:"); Serial.print(telemetry.temperature(1));  Serial.print(' '); }
+      if (telemetry.isValid(SABERTOOTH_TELEMETRY_TEMPERATURE2)) { Serial.print("Tmp2:"); Serial.print(telemetry.temperature(2));  Serial.print(' '); }
+      Serial.println();
+    }
+    
+    ST.async_getTelemetry(&telemetry);  // start the next sweep
+  }
+}